@@ -0,0 +1,94 @@
+// 02562 Rendering Framework
+// Build statistics of the acceleration structures and per-thread
+// counters of the work done by their traversal.
+// Copyright (c) DTU Informatics 2011
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include "AccStats.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+  // Threads beyond this number share counters, which only makes the
+  // counts inexact
+  const unsigned int max_counted_threads = 256;
+
+  // The counters of different threads are on different cache lines
+  struct PaddedTraversalStats
+  {
+    TraversalStats stats;
+    char pad[64];
+  };
+
+  PaddedTraversalStats thread_stats[max_counted_threads];
+}
+
+void AccStats::add_leaf(unsigned int depth, unsigned int count)
+{
+  if(depth >= depth_histogram.size())
+    depth_histogram.resize(depth + 1, 0);
+  ++depth_histogram[depth];
+  ++leaves;
+  references += count;
+  if(depth > max_depth)
+    max_depth = depth;
+}
+
+string AccStats::describe() const
+{
+  ostringstream ostr;
+  ostr << "Build statistics: " << nodes << " nodes, " << leaves << " leaves, max depth " << max_depth << ", "
+       << objects_per_leaf() << " objects per leaf, duplication factor " << duplication() << ", SAH cost "
+       << sah_cost << "." << endl << "Leaves per depth:";
+  for(unsigned int i = 0; i < depth_histogram.size(); ++i)
+    ostr << " " << depth_histogram[i];
+  return ostr.str();
+}
+
+TraversalStats& TraversalStats::operator+=(const TraversalStats& s)
+{
+  rays += s.rays;
+  hits += s.hits;
+  nodes += s.nodes;
+  primitives += s.primitives;
+  return *this;
+}
+
+string TraversalStats::describe() const
+{
+  double per_ray = rays > 0 ? 1.0/rays : 0.0;
+  ostringstream ostr;
+  ostr << "Traversal statistics: " << rays << " rays, " << nodes*per_ray << " nodes visited, "
+       << primitives*per_ray << " primitives tested and " << hits*per_ray << " hits per ray.";
+  return ostr.str();
+}
+
+TraversalStats& thread_traversal_stats()
+{
+#ifdef _OPENMP
+  return thread_stats[omp_get_thread_num() % max_counted_threads].stats;
+#else
+  return thread_stats[0].stats;
+#endif
+}
+
+TraversalStats gather_traversal_stats()
+{
+  TraversalStats sum;
+  for(unsigned int i = 0; i < max_counted_threads; ++i)
+    sum += thread_stats[i].stats;
+  return sum;
+}
+
+void reset_traversal_stats()
+{
+  for(unsigned int i = 0; i < max_counted_threads; ++i)
+    thread_stats[i].stats = TraversalStats();
+}
@@ -0,0 +1,62 @@
+// 02562 Rendering Framework
+// Build statistics of the acceleration structures and per-thread
+// counters of the work done by their traversal.
+// Copyright (c) DTU Informatics 2011
+
+#ifndef ACCSTATS_H
+#define ACCSTATS_H
+
+#include <vector>
+#include <string>
+
+// Quality of a built acceleration structure. A reference is the occurrence
+// of a primitive in a leaf, so the duplication factor is above one for
+// trees that store a primitive in several leaves.
+struct AccStats
+{
+  AccStats() : nodes(0), leaves(0), max_depth(0), primitives(0), references(0), sah_cost(0.0f) { }
+
+  void add_leaf(unsigned int depth, unsigned int count);
+  float objects_per_leaf() const { return leaves > 0 ? references/static_cast<float>(leaves) : 0.0f; }
+  float duplication() const { return primitives > 0 ? references/static_cast<float>(primitives) : 0.0f; }
+  std::string describe() const;
+
+  unsigned int nodes;                         // interior nodes and leaves
+  unsigned int leaves;
+  unsigned int max_depth;
+  unsigned int primitives;
+  unsigned int references;
+  std::vector<unsigned int> depth_histogram;  // number of leaves at each depth
+  float sah_cost;                             // expected cost of a ray relative to one primitive test
+};
+
+// Work done by the accelerators. The rays and hits are the queries made
+// through the scene, while the nodes and primitives include those visited
+// in the trees of instanced meshes.
+struct TraversalStats
+{
+  TraversalStats() : rays(0), hits(0), nodes(0), primitives(0) { }
+
+  TraversalStats& operator+=(const TraversalStats& s);
+  std::string describe() const;
+
+  unsigned long long rays;
+  unsigned long long hits;
+  unsigned long long nodes;
+  unsigned long long primitives;
+};
+
+// Counters of the calling thread and the sum over all threads. The
+// accelerators only count if the renderer is compiled with
+// RT_TRAVERSAL_STATS defined, so that other builds pay nothing.
+TraversalStats& thread_traversal_stats();
+TraversalStats gather_traversal_stats();
+void reset_traversal_stats();
+
+#ifdef RT_TRAVERSAL_STATS
+#define RT_COUNT(counter, n) (thread_traversal_stats().counter += (n))
+#else
+#define RT_COUNT(counter, n) ((void)0)
+#endif
+
+#endif // ACCSTATS_H
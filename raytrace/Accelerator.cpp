@@ -3,16 +3,58 @@
 // Copyright (c) DTU Informatics 2011
 
 #include <vector>
+#include <string>
+#include <sstream>
 #include <optix_world.h>
 #include "AccObj.h"
 #include "Object3D.h"
 #include "Plane.h"
 #include "HitInfo.h"
+#include "AccStats.h"
 #include "Accelerator.h"
 
 using namespace std;
 using namespace optix;
 
+namespace
+{
+  // Margin added to the scene bounds relative to their largest extent, so
+  // that surfaces lying in a face of the bounds are inside
+  const float bounds_eps = 1.0e-4f;
+
+  // Bounding box of the polygon in which a plane cuts a box. The polygon
+  // vertices are where the plane crosses the edges of the box. The box
+  // is invalid if the plane misses it.
+  Aabb clip_plane(const Plane& plane, const Aabb& box)
+  {
+    const float3& normal = plane.get_normal();
+    float d = -dot(plane.get_origin(), normal);
+    float3 corner[8];
+    float dist[8];
+    for(unsigned int i = 0; i < 8; ++i)
+    {
+      corner[i] = make_float3(i & 1 ? box.m_max.x : box.m_min.x,
+                              i & 2 ? box.m_max.y : box.m_min.y,
+                              i & 4 ? box.m_max.z : box.m_min.z);
+      dist[i] = dot(corner[i], normal) + d;
+    }
+
+    Aabb clipped;
+    for(unsigned int i = 0; i < 8; ++i)
+    {
+      if(dist[i] == 0.0f)
+        clipped.include(corner[i]);
+      for(unsigned int a = 1; a < 8; a <<= 1)
+      {
+        unsigned int j = i | a;
+        if(j != i && dist[i]*dist[j] < 0.0f)
+          clipped.include(corner[i] + (corner[j] - corner[i])*(dist[i]/(dist[i] - dist[j])));
+      }
+    }
+    return clipped;
+  }
+}
+
 Accelerator::~Accelerator()
 {
   for(unsigned int i = 0; i < primitives.size(); ++i)
@@ -21,21 +63,27 @@ Accelerator::~Accelerator()
 
 void Accelerator::init(const vector<Object3D*>& geometry, const vector<const Plane*>& scene_planes)
 {
+  for(unsigned int i = 0; i < primitives.size(); ++i)
+    delete primitives[i];
+  primitives.clear();
+  scene_objects = geometry;
   for(unsigned int i = 0; i < geometry.size(); ++i)
   {
     Object3D* obj = geometry[i];
     unsigned int no_of_prims = primitives.size();
-    primitives.resize(no_of_prims + obj->get_no_of_primitives());
-    for(unsigned int j = 0; j < obj->get_no_of_primitives(); ++j)
+    int obj_prims = static_cast<int>(obj->get_no_of_primitives());
+    primitives.resize(no_of_prims + obj_prims);
+    #pragma omp parallel for if(obj_prims > 4096)
+    for(int j = 0; j < obj_prims; ++j)
       primitives[j + no_of_prims] = new AccObj(obj, j);
   }
   planes = scene_planes;
+  first_plane_primitive = primitives.size();
+  clip_planes(false);
 }
 
 bool Accelerator::closest_hit(optix::Ray& r, HitInfo& hit) const
 {
-  closest_plane(r, hit);
-
   // Loop through all the primitives to find the closest intersection (if any).
   //
   // Input:  r    (the ray to be checked for intersection)
@@ -53,29 +101,68 @@ bool Accelerator::closest_hit(optix::Ray& r, HitInfo& hit) const
 
   for(int p = 0; p < primitives.size(); p++){
     AccObj* obj = primitives[p];
+    RT_COUNT(primitives, 1);
     if(obj->geometry->intersect(r, hit, obj->prim_idx))
       r.tmax = hit.dist;
   }
+  closest_plane(r, hit);
 
   return hit.has_hit;
 }
 
 bool Accelerator::any_hit(optix::Ray& r, HitInfo& hit) const
 {
-  if(!any_plane(r, hit))
+  for(unsigned int i = 0; i < primitives.size(); ++i)
   {
-    unsigned int i = 0;
-    while(i < primitives.size() && !hit.has_hit)
+    AccObj* obj = primitives[i];
+    RT_COUNT(primitives, 1);
+    if(obj->geometry->intersect_any(r, obj->prim_idx))
     {
-      AccObj* obj = primitives[i++];
-      obj->geometry->intersect(r, hit, obj->prim_idx);
+      hit.has_hit = true;
+      return true;
     }
   }
-  return hit.has_hit;
+  return any_plane(r, hit);
+}
+
+void Accelerator::closest_hit_packet(Ray* rays, HitInfo* hits, unsigned int n) const
+{
+  // Accelerators without a packet traversal trace the rays one by one
+  for(unsigned int i = 0; i < n; ++i)
+    closest_hit(rays[i], hits[i]);
+}
+
+void Accelerator::refit()
+{
+  if(!refit_primitives())
+    rebuild();
+}
+
+string Accelerator::describe() const
+{
+  ostringstream ostr;
+  ostr << "No acceleration structure (" << primitives.size() << " primitives, " << planes.size() << " planes).";
+  return ostr.str();
+}
+
+AccStats Accelerator::get_stats() const
+{
+  // All primitives are in one leaf, which every ray tests
+  AccStats stats;
+  stats.primitives = primitives.size();
+  if(primitives.size() > 0)
+  {
+    stats.nodes = 1;
+    stats.add_leaf(0, primitives.size());
+  }
+  stats.sah_cost = static_cast<float>(primitives.size());
+  return stats;
 }
 
 void Accelerator::closest_plane(Ray& r, HitInfo& hit) const
 {
+  if(planes.size() == 0 || inside_bounds(r))
+    return;
   for(unsigned int i = 0; i < planes.size(); ++i)
     if(planes[i]->intersect(r, hit, 0))
       r.tmax = hit.dist;
@@ -83,8 +170,98 @@ void Accelerator::closest_plane(Ray& r, HitInfo& hit) const
 
 bool Accelerator::any_plane(Ray& r, HitInfo& hit) const
 {
+  if(planes.size() == 0 || inside_bounds(r))
+    return false;
   for(unsigned int i = 0; i < planes.size(); ++i)
-    if(planes[i]->intersect(r, hit, 0))
+    if(planes[i]->intersect_any(r, 0))
+    {
+      hit.has_hit = true;
       return true;
+    }
   return false;
 }
+
+bool Accelerator::inside_bounds(const Ray& r) const
+{
+  // The bounds are convex, so the segment is inside if its end points are
+  return bounds.valid() && bounds.contains(r.origin + r.tmin*r.direction) && bounds.contains(r.origin + r.tmax*r.direction);
+}
+
+bool Accelerator::refit_primitives()
+{
+  unsigned int no_of_prims = 0;
+  for(unsigned int i = 0; i < scene_objects.size(); ++i)
+    no_of_prims += scene_objects[i]->get_no_of_primitives();
+  if(no_of_prims != first_plane_primitive)
+    return false;
+
+  int n = static_cast<int>(first_plane_primitive);
+  #pragma omp parallel for if(n > 4096)
+  for(int i = 0; i < n; ++i)
+    primitives[i]->bbox = primitives[i]->geometry->get_primitive_bbox(primitives[i]->prim_idx);
+  return clip_planes(true);
+}
+
+unsigned long long Accelerator::primitive_hash() const
+{
+  // 64-bit FNV-1a
+  unsigned long long hash = 14695981039346656037ULL;
+  for(unsigned int i = 0; i < primitives.size(); ++i)
+  {
+    const AccObj* obj = primitives[i];
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&obj->bbox);
+    for(unsigned int j = 0; j < sizeof(Aabb); ++j)
+      hash = (hash ^ bytes[j])*1099511628211ULL;
+    bytes = reinterpret_cast<const unsigned char*>(&obj->prim_idx);
+    for(unsigned int j = 0; j < sizeof(obj->prim_idx); ++j)
+      hash = (hash ^ bytes[j])*1099511628211ULL;
+  }
+  return hash;
+}
+
+void Accelerator::rebuild()
+{
+  // init(...) replaces the members that hold its arguments. Structures
+  // rebuilt for moving geometry are not worth caching.
+  cache_file.clear();
+  vector<Object3D*> geometry = scene_objects;
+  vector<const Plane*> scene_planes = planes;
+  init(geometry, scene_planes);
+}
+
+bool Accelerator::clip_planes(bool refit)
+{
+  // Bound the finite primitives and let the part of every plane inside
+  // the bounds be another primitive, which lets the planes take part in
+  // the traversal of an acceleration structure. A plane is only tested
+  // as a whole if a ray segment leaves the bounds. When refitting, the
+  // planes cutting the bounds must be the ones that did so before.
+  bounds.invalidate();
+  for(unsigned int i = 0; i < first_plane_primitive; ++i)
+    bounds.include(primitives[i]->bbox);
+  if(!bounds.valid())
+    return primitives.size() == first_plane_primitive;
+  float margin = bounds_eps*fmaxf(bounds.maxExtent(), 1.0f);
+  bounds.enlarge(margin);
+  unsigned int prim = first_plane_primitive;
+  for(unsigned int i = 0; i < planes.size(); ++i)
+  {
+    Aabb clipped = clip_plane(*planes[i], bounds);
+    if(!clipped.valid())
+      continue;
+    clipped.enlarge(margin);
+    if(refit)
+    {
+      if(prim == primitives.size() || primitives[prim]->geometry != planes[i])
+        return false;
+      primitives[prim++]->bbox = clipped;
+      continue;
+    }
+    AccObj* obj = new AccObj;
+    obj->geometry = const_cast<Plane*>(planes[i]);
+    obj->prim_idx = 0;
+    obj->bbox = clipped;
+    primitives.push_back(obj);
+  }
+  return !refit || prim == primitives.size();
+}
@@ -6,26 +6,69 @@
 #define ACCELERATOR_H
 
 #include <vector>
+#include <string>
 #include <optix_world.h>
 #include "AccObj.h"
 #include "Object3D.h"
 #include "Plane.h"
 #include "HitInfo.h"
+#include "AccStats.h"
+
+// Largest number of rays traced together by closest_hit_packet(...),
+// enough for the primary rays of an 8x8 pixel tile
+const unsigned int max_packet_size = 64;
 
 class Accelerator
 {
 public:
+  Accelerator() : first_plane_primitive(0) { }
   virtual ~Accelerator();
   virtual void init(const std::vector<Object3D*>& geometry, const std::vector<const Plane*>& scene_planes);
   virtual bool closest_hit(optix::Ray& r, HitInfo& hit) const;
   virtual bool any_hit(optix::Ray& r, HitInfo& hit) const;
+  virtual void closest_hit_packet(optix::Ray* rays, HitInfo* hits, unsigned int n) const;
+  virtual std::string describe() const;
+
+  // Statistics of the structure built by init(...)
+  virtual AccStats get_stats() const;
+
+  // Updates the accelerator after the geometry passed to init(...) has
+  // moved. The default updates the primitive bounds, or rebuilds if the
+  // number of primitives has changed.
+  virtual void refit();
+
+  // Accelerators that support it store their structure in the given file
+  // after building it, and load it instead of building it if the file
+  // was stored for the same primitives
+  void set_cache_file(const std::string& filename) { cache_file = filename; }
 
 protected:
+  // Recomputes the bounds of the primitives and of the clipped planes.
+  // Returns false if the primitives no longer match the geometry, which
+  // happens if primitives were added or a plane entered or left the bounds.
+  bool refit_primitives();
+  void rebuild();
+
+  // Hash of the primitive bounds, which are all an accelerator is built from
+  unsigned long long primitive_hash() const;
+
+  // The part of every plane inside the bounds of the other primitives is
+  // stored as an ordinary primitive. These functions only test the planes
+  // if the ray segment [r.tmin, r.tmax] leaves the bounds, so they must be
+  // called after the primitives have been intersected.
   void closest_plane(optix::Ray& r, HitInfo& hit) const;
   bool any_plane(optix::Ray& r, HitInfo& hit) const;
+  bool inside_bounds(const optix::Ray& r) const;
 
+  std::vector<Object3D*> scene_objects;
   std::vector<AccObj*> primitives;
   std::vector<const Plane*> planes;
+  unsigned int first_plane_primitive;
+  optix::Aabb bounds;
+  std::string cache_file;
+
+private:
+  bool clip_planes(bool refit);
 };
 
 #endif // ACCELERATOR_H
\ No newline at end of file
@@ -0,0 +1,74 @@
+// 02562 Rendering Framework
+// Per-pixel variance of a progressive render and the tiles whose error
+// estimate is still above a threshold.
+// Copyright (c) DTU Informatics 2011
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+#include <optix_world.h>
+#include "AdaptiveSampler.h"
+
+using namespace std;
+using namespace optix;
+
+void AdaptiveSampler::init(const TileScheduler& scheduler, unsigned int w, unsigned int h)
+{
+  width = w;
+  squared_diffs.resize(w*h);
+  samples.resize(scheduler.get_no_of_tiles());
+  errors.resize(scheduler.get_no_of_tiles());
+  clear();
+}
+
+void AdaptiveSampler::clear()
+{
+  std::fill(squared_diffs.begin(), squared_diffs.end(), 0.0f);
+  std::fill(samples.begin(), samples.end(), 0);
+  std::fill(errors.begin(), errors.end(), 1.0e30f);
+  update_active();
+}
+
+void AdaptiveSampler::finish_tile(unsigned int tile, const RenderTile& area, const TiledImage& image)
+{
+  unsigned int n = ++samples[tile];
+  if(n < 2)
+    return;
+
+  double sum = 0.0;
+  for(unsigned int j = area.y; j < area.y + area.h; ++j)
+    for(unsigned int i = area.x; i < area.x + area.w; ++i)
+    {
+      unsigned int p = i + j*width;
+      const float3& mean = image.at(i, j);
+      float variance_of_mean = squared_diffs[p]/((n - 1.0f)*n);
+      float y = std::max((mean.x + mean.y + mean.z)/3.0f, 1.0e-4f);
+      sum += variance_of_mean/y;
+    }
+  errors[tile] = static_cast<float>(sqrt(sum/(area.w*area.h)));
+}
+
+void AdaptiveSampler::update_active()
+{
+  active.clear();
+  for(unsigned int i = 0; i < samples.size(); ++i)
+    if(!enabled || samples[i] < min_samples || errors[i] > threshold)
+      active.push_back(i);
+}
+
+string AdaptiveSampler::describe() const
+{
+  unsigned int fewest = samples.empty() ? 0 : *std::min_element(samples.begin(), samples.end());
+  unsigned int most = samples.empty() ? 0 : *std::max_element(samples.begin(), samples.end());
+  float largest = 0.0f;
+  for(unsigned int i = 0; i < errors.size(); ++i)
+    if(samples[i] >= 2)
+      largest = std::max(largest, errors[i]);
+  ostringstream ostr;
+  ostr << "Adaptive sampling " << (enabled ? "on" : "off") << ": " << active.size() << " of " << samples.size()
+       << " tiles active, largest tile error " << largest << " (threshold " << threshold << "), "
+       << fewest << " to " << most << " samples per pixel.";
+  return ostr.str();
+}
@@ -0,0 +1,74 @@
+// 02562 Rendering Framework
+// Per-pixel variance of a progressive render and the tiles whose error
+// estimate is still above a threshold.
+// Copyright (c) DTU Informatics 2011
+
+#ifndef ADAPTIVESAMPLER_H
+#define ADAPTIVESAMPLER_H
+
+#include <vector>
+#include <string>
+#include <optix_world.h>
+#include "TileScheduler.h"
+#include "TiledImage.h"
+
+// The running mean of every pixel is kept with the sum of squared
+// differences from it [Welford, Technometrics 4(3), 1962], which gives
+// the standard error of the mean. The error of a pixel is its standard
+// error divided by the square root of its mean, which weighs dark
+// pixels more than the absolute error and less than the relative error
+// [Dammertz et al., A hierarchical automatic stopping condition for Monte
+// Carlo global illumination, WSCG 2010]. A tile has converged when the
+// root mean square error of its pixels is below the threshold. All the
+// pixels of a tile have the same number of samples.
+class AdaptiveSampler
+{
+public:
+  AdaptiveSampler(float error_threshold = 0.05f, unsigned int min_samples_per_pixel = 16)
+    : threshold(error_threshold), min_samples(min_samples_per_pixel), enabled(false), width(0)
+  { }
+
+  void init(const TileScheduler& scheduler, unsigned int w, unsigned int h);
+  void clear();
+
+  // Adds sample L as sample number n of pixel p with the given mean
+  void add_sample(unsigned int p, const optix::float3& L, optix::float3& mean, unsigned int n)
+  {
+    float y = (L.x + L.y + L.z)/3.0f;
+    float old_y = (mean.x + mean.y + mean.z)/3.0f;
+    mean += (L - mean)/static_cast<float>(n + 1);
+    float new_y = (mean.x + mean.y + mean.z)/3.0f;
+    squared_diffs[p] += (y - old_y)*(y - new_y);
+  }
+
+  // Counts the sample just added to all the pixels of a tile and updates
+  // its error estimate. Tiles may be finished in parallel.
+  void finish_tile(unsigned int tile, const RenderTile& area, const TiledImage& image);
+
+  // Selects the tiles of the next pass once all tiles of a pass are done
+  void update_active();
+
+  // Tiles to render in the next pass in render order, which are all
+  // tiles if adaptive sampling is disabled
+  const std::vector<unsigned int>& get_active_tiles() const { return active; }
+  unsigned int get_samples(unsigned int tile) const { return samples[tile]; }
+  bool is_converged() const { return enabled && active.empty(); }
+
+  bool toggle() { enabled = !enabled; update_active(); return enabled; }
+  bool is_enabled() const { return enabled; }
+  void set_threshold(float error_threshold) { threshold = error_threshold; update_active(); }
+  float get_threshold() const { return threshold; }
+  std::string describe() const;
+
+private:
+  float threshold;
+  unsigned int min_samples;
+  bool enabled;
+  unsigned int width;
+  std::vector<float> squared_diffs;
+  std::vector<unsigned int> samples;
+  std::vector<float> errors;
+  std::vector<unsigned int> active;
+};
+
+#endif // ADAPTIVESAMPLER_H
@@ -6,6 +6,7 @@
 #include "IndexedFaceSet.h"
 #include "ObjMaterial.h"
 #include "mt_random.h"
+#include "PixelSampler.h"
 #include "cdf_bsearch.h"
 #include "HitInfo.h"
 #include "AreaLight.h"
@@ -60,21 +61,21 @@ bool AreaLight::sample(const float3& pos, float3& dir, float3& L) const
       float epsilon = 10e-4;
       Ray r(pos, dir, 0, epsilon, length(mesh->compute_bbox().center() - pos) - epsilon);
       HitInfo hit;
-      return !tracer->trace_to_closest(r, hit);
+      return !tracer->trace_to_any(r, hit);
     }
   } else {
 
     // Worksheet 7 area light with true sampling
 
     // sample a triangle (1 out of n triangles in mesh)
-    int rand_index = round(mt_random() * (mesh->face_areas.size() - 1));
+    int rand_index = round(next_sample() * (mesh->face_areas.size() - 1));
 
     uint3 triangle = mesh->geometry.face(rand_index);
 
     // Sample position on the triangle
     // Get random numbers
-    float rand1 = mt_random_half_open();
-    float rand2 = mt_random_half_open();
+    float rand1 = next_sample();
+    float rand2 = next_sample();
     //Sample barycentric coords
     float u = 1.0 - sqrtf(rand1);
     float v = (1.0 - rand2) * sqrtf(rand1);
@@ -97,7 +98,7 @@ bool AreaLight::sample(const float3& pos, float3& dir, float3& L) const
       float epsilon = 10e-4;
       Ray r(pos, dir, 0, epsilon, length(t) - epsilon);
       HitInfo hit;
-      return !tracer->trace_to_closest(r, hit);
+      return !tracer->trace_to_any(r, hit);
     }
 
     return true;
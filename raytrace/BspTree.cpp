@@ -5,6 +5,9 @@
 // Copyright (c) DTU Informatics 2011
 
 #include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
 #include <optix_world.h>
 #include "AccObj.h"
 #include "Object3D.h"
@@ -18,21 +21,52 @@ namespace
 {
   const float f_eps = 1.0e-6f;  
   const float d_eps = 1.0e-12f;
-}
 
-BspTree::~BspTree()
-{
-  delete_node(root);
+  // Traversal pushes at most one node per level of the tree
+  const unsigned int bsp_max_stack = 64;
+
+  struct BspStackEntry
+  {
+    unsigned int node;
+    float tmin;
+    float tmax;
+  };
+
+  // Same costs as in the BVH build (see BvhTree.cpp)
+  const float traversal_cost = 0.125f;
+  const float intersection_cost = 1.0f;
+
+  struct BspStatsEntry
+  {
+    unsigned int node;
+    unsigned int depth;
+    Aabb bbox;
+  };
 }
 
 void BspTree::init(const vector<Object3D*>& geometry, const std::vector<const Plane*>& scene_planes)
 {
-  root = new BspNode;
+  max_level = std::min(max_level, bsp_max_stack - 1);
+  BspNode* root = new BspNode;
   Accelerator::init(geometry, scene_planes);
-  for(unsigned int i = 0; i < geometry.size(); ++i)
-    bbox.include(geometry[i]->compute_bbox());
+
+  // The bounds of the primitives include the clipped planes and a margin,
+  // which keeps intersect_min_max(...) from cutting off hits on surfaces
+  // that lie in a face of the box
+  bbox.invalidate();
+  for(unsigned int i = 0; i < primitives.size(); ++i)
+    bbox.include(primitives[i]->bbox);
+  if(bounds.valid())
+    bbox.include(bounds);
   vector<AccObj*> objects = primitives;
+  tree_objects.clear();
   subdivide_node(*root, bbox, 0, objects);
+
+  // Store the tree depth first in one array and free the pointer based tree
+  nodes.clear();
+  flatten_node(*root);
+  delete_node(root);
+  triangles.init(tree_objects);
 }
 
 bool BspTree::closest_hit(Ray& r, HitInfo& hit) const
@@ -42,9 +76,14 @@ bool BspTree::closest_hit(Ray& r, HitInfo& hit) const
   // Using intersect_min_max(...) before intersect_node(...) gives
   // a good speed-up in many scenes.
 
+  // The planes are tested against the part of the ray outside the tree
+  float tmin = r.tmin;
+  float tmax = r.tmax;
+  if(intersect_min_max(r) && intersect_node(r, hit, false))
+    tmax = r.tmax;
+  r.tmin = tmin;
+  r.tmax = tmax;
   closest_plane(r, hit);
-  intersect_min_max(r);
-  intersect_node(r,hit,*root);
   return hit.has_hit;
 
   //return Accelerator::closest_hit(r, hit);
@@ -57,16 +96,71 @@ bool BspTree::any_hit(Ray& r, HitInfo& hit) const
   // Using intersect_min_max(...) before intersect_node(...) gives
   // a good speed-up in many scenes.
 
-  if(!any_plane(r, hit))
-  {
-    intersect_min_max(r);
-    intersect_node(r,hit,*root);
-  }
-  return hit.has_hit;
+  float tmin = r.tmin;
+  float tmax = r.tmax;
+  if(intersect_min_max(r) && intersect_node(r, hit, true))
+    return true;
+  r.tmin = tmin;
+  r.tmax = tmax;
+  return any_plane(r, hit);
 
   //return Accelerator::any_hit(r, hit);
 }
 
+string BspTree::describe() const
+{
+  ostringstream ostr;
+  unsigned int refs = tree_objects.size() - std::count(tree_objects.begin(), tree_objects.end(), static_cast<AccObj*>(0));
+  ostr << "BSP tree (" << nodes.size() << " nodes, " << refs << " object references to " << primitives.size() 
+       << " primitives, " << planes.size() << " planes).";
+  return ostr.str();
+}
+
+AccStats BspTree::get_stats() const
+{
+  // The cell of a node is the part of the bounds of the tree on its
+  // side of the splitting planes above it
+  AccStats stats;
+  stats.nodes = nodes.size();
+  stats.primitives = primitives.size();
+  if(nodes.size() == 0)
+    return stats;
+
+  float cost = 0.0f;
+  vector<BspStatsEntry> stack(1);
+  stack[0].node = 0;
+  stack[0].depth = 0;
+  stack[0].bbox = bbox;
+  while(!stack.empty())
+  {
+    BspStatsEntry entry = stack.back();
+    stack.pop_back();
+    const BspFlatNode& node = nodes[entry.node];
+    if(node.is_leaf())
+    {
+      stats.add_leaf(entry.depth, node.count());
+      cost += entry.bbox.area()*node.count()*intersection_cost;
+      continue;
+    }
+    cost += entry.bbox.area()*traversal_cost;
+    unsigned int axis = node.axis_leaf();
+    BspStatsEntry below = entry, above = entry;
+    below.node = entry.node + 1;
+    above.node = node.right_child();
+    below.depth = above.depth = entry.depth + 1;
+
+    // Planes placed beside all objects of a node may be outside its cell
+    float plane = fminf(fmaxf(node.plane, *(&entry.bbox.m_min.x + axis)), *(&entry.bbox.m_max.x + axis));
+    *(&below.bbox.m_max.x + axis) = plane;
+    *(&above.bbox.m_min.x + axis) = plane;
+    stack.push_back(below);
+    stack.push_back(above);
+  }
+  float root_area = bbox.area();
+  stats.sah_cost = root_area > 0.0f ? cost/root_area : cost;
+  return stats;
+}
+
 bool BspTree::intersect_min_max(Ray& r) const
 {
   float3 p1 = (bbox.m_min - r.origin)/r.direction;
@@ -120,7 +214,8 @@ void BspTree::subdivide_node(BspNode& node, Aabb& bbox, unsigned int level, vect
     node.id = tree_objects.size();
     node.count = objects.size();
 
-    tree_objects.resize(tree_objects.size() + objects.size());
+    // Leaves start at a whole block of the triangle buffer
+    tree_objects.resize(tree_objects.size() + TriangleBuffer::padded_size(objects.size()), 0);
     for(unsigned int i = 0; i < objects.size(); ++i)
       tree_objects[node.id + i] = objects[i];
   }
@@ -226,81 +321,150 @@ void BspTree::subdivide_node(BspNode& node, Aabb& bbox, unsigned int level, vect
   }
 }
 
-bool BspTree::intersect_node(Ray& ray, HitInfo& hit, const BspNode& node) const 
+void BspTree::flatten_node(const BspNode& node)
 {
-  // This is a recursive function computing ray-scene intersection
-  // using the BSP tree.
+  unsigned int node_idx = nodes.size();
+  nodes.push_back(BspFlatNode());
+  if(node.axis_leaf == bsp_leaf)
+    nodes[node_idx].init_leaf(node.id, node.count);
+  else
+  {
+    flatten_node(*node.left);
+    nodes[node_idx].init_interior(node.axis_leaf, node.plane, nodes.size());
+    flatten_node(*node.right);
+  }
+}
+
+bool BspTree::intersect_node(Ray& ray, HitInfo& hit, bool occlusion_only) const 
+{
+  // This function computes ray-scene intersection by an iterative
+  // front-to-back traversal of the BSP tree.
   //
-  // Input:  ray       (ray to find the first intersection for)
-  //         node      (node of the BSP tree to intersect with)
+  // Input:  ray            (ray to find the first intersection for)
+  //         occlusion_only (stop at any intersection and skip the hit info)
   //
-  // Output: ray.tmin  (minimum distance to intersection after considering the node)
-  //         ray.tmax  (maximum distance to intersection after considering the node)
-  //         hit       (hit info retrieved from primitive intersection function)
+  // Output: ray.tmax       (distance to the intersection if one was found)
+  //         hit            (hit info retrieved from primitive intersection function,
+  //                         only hit.has_hit is set if occlusion_only is true)
   //
   // Relevant data fields that are available (see BspTree.h)
   // tree_objects      (array of primitive objects associated with leaves)
-  // 
+  // triangles         (precomputed triangles, same order as tree_objects)
+  // nodes             (array of tree nodes, the left child of a node is the next node)
   //
-  // Hint: Stop the recursion once a leaf node has been found and get
-  //       access to the intersect function of a primitive object through
-  //       the geometry field.
+  // Far children that the ray segment reaches are pushed on a fixed size
+  // stack together with their part of the segment. Since leaves are visited
+  // front to back, a hit in a leaf is closer than anything in the nodes left
+  // on the stack and the traversal stops.
 
-  if(node.axis_leaf == bsp_leaf)
+  BspStackEntry stack[bsp_max_stack];
+  unsigned int stack_size = 0;
+  unsigned int node_idx = 0;
+  float t_min = ray.tmin;
+  float t_max = ray.tmax;
+  for(;;)
   {
-    bool found = false;
-    for(unsigned int i = 0; i < node.count; ++i)
+    const BspFlatNode& node = nodes[node_idx];
+    RT_COUNT(nodes, 1);
+    if(!node.is_leaf())
     {
-      const AccObj* obj = tree_objects[node.id + i];
-      if(obj->geometry->intersect(ray, hit, obj->prim_idx))
+      unsigned int axis = node.axis_leaf();
+      float axis_direction = *(&ray.direction.x + axis);
+      float axis_origin = *(&ray.origin.x + axis);
+      unsigned int near_node = node_idx + 1;
+      unsigned int far_node = node.right_child();
+      if(axis_direction < 0.0f)
+        std::swap(near_node, far_node);
+
+      // In order to avoid instability
+      float t;
+      if(fabs(axis_direction) < d_eps)
+        t = (node.plane - axis_origin)/d_eps; // intersect node plane;
+      else
+        t = (node.plane - axis_origin)/axis_direction; // intersect node plane;
+
+      if(t > t_max)
+        node_idx = near_node;
+      else if(t < t_min)
+        node_idx = far_node;
+      else
       {
-        ray.tmax = hit.dist;
-        found = true;
+        BspStackEntry& entry = stack[stack_size++];
+        entry.node = far_node;
+        entry.tmin = t;
+        entry.tmax = t_max;
+        node_idx = near_node;
+        t_max = t;
       }
+      continue;
     }
-    return found;
-  }
-  else
-  {
-    BspNode *near_node;
-    BspNode *far_node;
-    float axis_direction = *(&ray.direction.x + node.axis_leaf);
-    float axis_origin = *(&ray.origin.x + node.axis_leaf);
-    if(axis_direction >= 0.0f)
+
+    ray.tmin = t_min;
+    ray.tmax = t_max;
+    bool found = false;
+    int closest = -1;
+    float closest_beta = 0.0f;
+    float closest_gamma = 0.0f;
+    unsigned int count = node.count();
+    RT_COUNT(primitives, count);
+    if(occlusion_only)
     {
-      near_node = node.left;
-      far_node = node.right;
+      if(triangles.intersect_any(ray, node.id, count))
+      {
+        hit.has_hit = true;
+        return true;
+      }
     }
     else
     {
-      near_node = node.right;
-      far_node = node.left;
+      float t;
+      closest = triangles.intersect(ray, node.id, count, t, closest_beta, closest_gamma);
+      if(closest >= 0)
+      {
+        ray.tmax = t;
+        found = true;
+      }
     }
-
-    // In order to avoid instability
-    float t;
-    if(fabs(axis_direction) < d_eps)
-      t = (node.plane - axis_origin)/d_eps; // intersect node plane;
-    else
-      t = (node.plane - axis_origin)/axis_direction; // intersect node plane;
-
-    if(t > ray.tmax)
-      return intersect_node(ray, hit, *near_node);
-    else if(t < ray.tmin)
-      return intersect_node(ray, hit, *far_node);
-    else
+    if(!triangles.only_triangles())
     {
-      float t_max = ray.tmax;
-      ray.tmax = t;
-      if(intersect_node(ray, hit, *near_node))
-        return true;
-      else
+      for(unsigned int i = node.id; i < node.id + count; ++i)
+      {
+        const AccObj* obj = tree_objects[i];
+        if(triangles.is_triangle(i))
+          continue;
+        if(occlusion_only)
+        {
+          if(obj->geometry->intersect_any(ray, obj->prim_idx))
+          {
+            hit.has_hit = true;
+            return true;
+          }
+        }
+        else if(obj->geometry->intersect(ray, hit, obj->prim_idx))
+        {
+          ray.tmax = hit.dist;
+          closest = -1;
+          found = true;
+        }
+      }
+    }
+    if(found)
+    {
+      // Only the closest triangle in the leaf needs its hit info
+      if(closest >= 0)
       {
-        ray.tmin = t;
-        ray.tmax = t_max;
-        return intersect_node(ray, hit, *far_node);
+        const AccObj* obj = tree_objects[closest];
+        obj->geometry->fill_hit_info(ray, hit, obj->prim_idx, ray.tmax, closest_beta, closest_gamma);
       }
+      return true;
     }
+    if(stack_size == 0)
+      return false;
+
+    const BspStackEntry& entry = stack[--stack_size];
+    node_idx = entry.node;
+    t_min = entry.tmin;
+    t_max = entry.tmax;
   }
 }
 
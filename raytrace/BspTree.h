@@ -8,12 +8,14 @@
 #define BSPTREE_H
 
 #include <vector>
+#include <string>
 #include <optix_world.h>
 #include "AccObj.h"
 #include "Object3D.h"
 #include "Plane.h"
 #include "HitInfo.h"
 #include "Accelerator.h"
+#include "TriangleBuffer.h"
 
 enum BspNodeType { bsp_x_axis, bsp_y_axis, bsp_z_axis, bsp_leaf };
 
@@ -29,26 +31,61 @@ struct BspNode
   unsigned int ref;
 };
 
+// Compact 8-byte node used for traversal. The tree is stored depth first
+// in a single array so that the left (below) child of a node is the next
+// node in the array and only the index of the right (above) child is kept.
+struct BspFlatNode
+{
+  void init_leaf(unsigned int first_object, unsigned int object_count)
+  {
+    id = first_object;
+    flags = bsp_leaf | (object_count << 2);
+  }
+  void init_interior(BspNodeType axis, float split_plane, unsigned int right_child)
+  {
+    plane = split_plane;
+    flags = axis | (right_child << 2);
+  }
+
+  BspNodeType axis_leaf() const { return static_cast<BspNodeType>(flags & 3); }
+  bool is_leaf() const { return (flags & 3) == bsp_leaf; }
+  unsigned int count() const { return flags >> 2; }
+  unsigned int right_child() const { return flags >> 2; }
+
+  union
+  {
+    float plane;        // displacement of the splitting plane (interior nodes)
+    unsigned int id;    // index of the first object in tree_objects (leaves)
+  };
+  unsigned int flags;   // low 2 bits: axis or leaf, high 30 bits: object count (leaves) or right child index
+};
+
 class BspTree : public Accelerator
 {
 public:
   BspTree(unsigned int max_objects_in_leaf = 4, unsigned int max_levels_in_tree = 20) 
-    : root(0), max_objects(max_objects_in_leaf), max_level(max_levels_in_tree) 
+    : max_objects(max_objects_in_leaf), max_level(max_levels_in_tree) 
   { }
 
-  virtual ~BspTree();
   virtual void init(const std::vector<Object3D*>& geometry, const std::vector<const Plane*>& planes);
   virtual bool closest_hit(optix::Ray& r, HitInfo& hit) const;
   virtual bool any_hit(optix::Ray& r, HitInfo& hit) const;
+  virtual std::string describe() const;
+  virtual AccStats get_stats() const;
+
+  // Moving geometry changes the spatial subdivision, so the tree is rebuilt
+  virtual void refit() { rebuild(); }
 
 private:
   bool intersect_min_max(optix::Ray& ray) const;
   void subdivide_node(BspNode& node, optix::Aabb& bbox, unsigned int level, std::vector<AccObj*>& objects);
-  bool intersect_node(optix::Ray& ray, HitInfo& hit, const BspNode& node) const;
+  void flatten_node(const BspNode& node);
+  bool intersect_node(optix::Ray& ray, HitInfo& hit, bool occlusion_only) const;
   void delete_node(BspNode *node);
 
   std::vector<AccObj*> tree_objects;
-  BspNode* root;
+  std::vector<BspFlatNode> nodes;
+  TriangleBuffer triangles;
   optix::Aabb bbox;
   unsigned int max_objects;
   unsigned int max_level;
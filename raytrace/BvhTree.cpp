@@ -0,0 +1,1251 @@
+// 02562 Rendering Framework
+// Bounding volume hierarchy with binned SAH splits
+// [Wald, IEEE Symposium on Interactive Ray Tracing 2007].
+// Copyright (c) DTU Informatics 2011
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+#ifdef _MSC_VER
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+#include <optix_world.h>
+#include "AccObj.h"
+#include "Object3D.h"
+#include "HitInfo.h"
+#include "BvhTree.h"
+
+using namespace std;
+using namespace optix;
+
+namespace
+{
+  const float f_eps = 1.0e-6f;
+
+  // Cost of a traversal step relative to the cost of a primitive intersection
+  const float traversal_cost = 0.125f;
+  const float intersection_cost = 1.0f;
+
+  // Leaves are intersected a whole block of triangles at the time (see
+  // TriangleBuffer), so a leaf costs the same for any number of objects
+  // up to the block size
+  inline float leaf_cost(unsigned int count)
+  {
+    return intersection_cost*((count + triangle_block_size - 1)/triangle_block_size);
+  }
+
+  // Below this depth, nodes are split at the object median to bound the
+  // depth of the tree and thereby the size of the traversal stack.
+  const unsigned int median_depth = 32;
+  const unsigned int max_stack = 64;
+
+  // Nodes with fewer objects than this are built by a single thread
+  const unsigned int parallel_threshold = 4096;
+  const unsigned int partition_blocks = 64;
+
+  // Spatial splits are only tried where the children of the best object
+  // split overlap by more than this fraction of the surface area of the root
+  const float overlap_threshold = 1.0e-5f;
+
+  // Cache files start with this header. The version must be incremented
+  // whenever the layout of BvhNode or of the file changes, or when the
+  // builder changes the trees it makes.
+  const char cache_magic[4] = { 'B', 'V', 'H', 'C' };
+  const unsigned int cache_version = 4;
+
+  struct BvhCacheHeader
+  {
+    char magic[4];
+    unsigned int version;
+    unsigned long long hash;
+    unsigned int max_objects;
+    unsigned int block_leaves;
+    unsigned int bins;
+    unsigned int no_of_primitives;
+    unsigned int no_of_nodes;
+    unsigned int no_of_objects;
+    unsigned int leaves;
+    unsigned int max_depth;
+    float build_cost;
+    float split_budget;
+  };
+
+  inline float centroid(const AccObj* obj, unsigned int axis)
+  {
+    return 0.5f*(*(&obj->bbox.m_min.x + axis) + *(&obj->bbox.m_max.x + axis));
+  }
+
+  inline unsigned int bin_index(float c, float c_min, float k, unsigned int bins)
+  {
+    unsigned int b = static_cast<unsigned int>(k*(c - c_min));
+    return b < bins ? b : bins - 1;
+  }
+
+  struct LeftOfSplit
+  {
+    LeftOfSplit(unsigned int a, float min, float scale, unsigned int no_of_bins, unsigned int split)
+      : axis(a), c_min(min), k(scale), bins(no_of_bins), split_bin(split)
+    { }
+
+    bool operator()(const AccObj* obj) const
+    {
+      return bin_index(centroid(obj, axis), c_min, k, bins) <= split_bin;
+    }
+
+    unsigned int axis;
+    float c_min;
+    float k;
+    unsigned int bins;
+    unsigned int split_bin;
+  };
+
+  struct CentroidLess
+  {
+    CentroidLess(unsigned int a) : axis(a) { }
+
+    bool operator()(const AccObj* a, const AccObj* b) const
+    {
+      return centroid(a, axis) < centroid(b, axis);
+    }
+
+    unsigned int axis;
+  };
+
+  struct ReferenceCentroidLess
+  {
+    ReferenceCentroidLess(unsigned int a) : axis(a) { }
+
+    bool operator()(const BvhReference& a, const BvhReference& b) const
+    {
+      return a.bbox.center(axis) < b.bbox.center(axis);
+    }
+
+    unsigned int axis;
+  };
+
+  // Bounds of the part of a referenced object between two planes
+  // perpendicular to the given axis. Triangles are clipped exactly,
+  // other objects are represented by their bounding box.
+  Aabb clip_reference(const BvhReference& ref, unsigned int axis, float lo, float hi)
+  {
+    Aabb clipped;
+    float3 v[3];
+    if(ref.obj->geometry->get_triangle(ref.obj->prim_idx, v[0], v[1], v[2]))
+    {
+      for(unsigned int i = 0; i < 3; ++i)
+      {
+        const float3& p = v[i];
+        const float3& q = v[(i + 1)%3];
+        float a = *(&p.x + axis);
+        float b = *(&q.x + axis);
+        if(a >= lo && a <= hi)
+          clipped.include(p);
+        if((a < lo) != (b < lo))
+          clipped.include(p + (q - p)*((lo - a)/(b - a)));
+        if((a > hi) != (b > hi))
+          clipped.include(p + (q - p)*((hi - a)/(b - a)));
+      }
+
+      // Round-off in the edge intersections must not shrink the bounds
+      if(clipped.valid())
+        clipped.enlarge(f_eps*ref.bbox.maxExtent());
+      clipped.intersection(ref.bbox);
+    }
+    else
+      clipped = ref.bbox;
+    *(&clipped.m_min.x + axis) = fmaxf(*(&clipped.m_min.x + axis), lo);
+    *(&clipped.m_max.x + axis) = fminf(*(&clipped.m_max.x + axis), hi);
+    return clipped;
+  }
+
+  struct LargerTask
+  {
+    bool operator()(const BvhBuildTask& a, const BvhBuildTask& b) const
+    {
+      return a.end - a.begin > b.end - b.begin;
+    }
+  };
+
+  struct BvhPacketStackEntry
+  {
+    unsigned int node;
+    unsigned int first;  // first ray of the packet that may hit the node
+  };
+
+  // Intervals enclosing the origins, inverse directions, and parameter
+  // ranges of all rays in a packet [Boulos et al., Interval and Frustum
+  // Traversal, 2006]. The rays must agree on the sign of every direction
+  // component, so that the near and far plane of each slab are the same.
+  struct PacketInterval
+  {
+    PacketInterval()
+      : o_min(make_float3(1.0e37f)), o_max(make_float3(-1.0e37f)),
+        inv_min(make_float3(1.0e37f)), inv_max(make_float3(-1.0e37f)), t_min(1.0e37f)
+    { }
+
+    void include(const Ray& r, const float3& inv_dir)
+    {
+      o_min = fminf(o_min, r.origin);
+      o_max = fmaxf(o_max, r.origin);
+      inv_min = fminf(inv_min, inv_dir);
+      inv_max = fmaxf(inv_max, inv_dir);
+      t_min = fminf(t_min, r.tmin);
+      for(unsigned int a = 0; a < 3; ++a)
+        sign[a] = *(&inv_dir.x + a) < 0.0f;
+    }
+
+    // Returns true if no ray in the packet can hit the box within [t_min, t_max]
+    bool misses(const Aabb& bbox, float t_max) const
+    {
+      float entry = t_min;
+      float exit = t_max;
+      for(unsigned int a = 0; a < 3; ++a)
+      {
+        float near_plane = *(&(sign[a] ? bbox.m_max : bbox.m_min).x + a);
+        float far_plane = *(&(sign[a] ? bbox.m_min : bbox.m_max).x + a);
+        float o0 = *(&o_min.x + a), o1 = *(&o_max.x + a);
+        float inv0 = *(&inv_min.x + a), inv1 = *(&inv_max.x + a);
+
+        // Lower bound of the entry distances and upper bound of the exit distances
+        entry = fmaxf(entry, fminf(fminf((near_plane - o0)*inv0, (near_plane - o0)*inv1),
+                                   fminf((near_plane - o1)*inv0, (near_plane - o1)*inv1)));
+        exit = fminf(exit, fmaxf(fmaxf((far_plane - o0)*inv0, (far_plane - o0)*inv1),
+                                 fmaxf((far_plane - o1)*inv0, (far_plane - o1)*inv1)));
+      }
+      return entry > exit;
+    }
+
+    float3 o_min, o_max;
+    float3 inv_min, inv_max;
+    float t_min;
+    unsigned int sign[3];
+  };
+
+  bool same_direction_signs(const Ray* rays, unsigned int n)
+  {
+    for(unsigned int a = 0; a < 3; ++a)
+    {
+      float d = *(&rays[0].direction.x + a);
+      if(d == 0.0f)
+        return false;
+      for(unsigned int i = 1; i < n; ++i)
+        if((*(&rays[i].direction.x + a) < 0.0f) != (d < 0.0f) || *(&rays[i].direction.x + a) == 0.0f)
+          return false;
+    }
+    return true;
+  }
+}
+
+void BvhTree::init(const vector<Object3D*>& geometry, const vector<const Plane*>& scene_planes)
+{
+  Accelerator::init(geometry, scene_planes);
+  tree_objects = primitives;
+  nodes.clear();
+  leaves = 0;
+  max_depth = 0;
+  references = 0;
+  if(tree_objects.size() == 0)
+    return;
+  if(!cache_file.empty() && load_cache())
+    return;
+
+  vector<BvhNode> build_nodes;
+  vector<AccObj*> build_objects;
+  if(split_budget > 0.0f)
+  {
+    // Spatial splits duplicate references, so node slots cannot be reserved
+    // in advance and the tree is built depth-first by a single thread
+    vector<BvhReference> refs(tree_objects.size());
+    for(unsigned int i = 0; i < tree_objects.size(); ++i)
+    {
+      refs[i].obj = tree_objects[i];
+      refs[i].bbox = tree_objects[i]->bbox;
+    }
+    Aabb root_bbox;
+    for(unsigned int i = 0; i < refs.size(); ++i)
+      root_bbox.include(refs[i].bbox);
+    unsigned int budget = static_cast<unsigned int>(split_budget*tree_objects.size());
+    build_spatial(build_nodes, build_objects, refs, root_bbox.halfArea(), 0, budget);
+    tree_objects.clear();
+  }
+  else
+  {
+    // Split the upper levels with parallel binning and partitioning, then
+    // build the remaining subtrees in parallel. A binary tree with at least
+    // one object per leaf has at most 2n - 1 nodes.
+    build_nodes.resize(2*tree_objects.size() - 1);
+    vector<BvhBuildTask> tasks;
+    build_node(build_nodes, 0, 0, tree_objects.size(), 0, &tasks);
+    sort(tasks.begin(), tasks.end(), LargerTask());
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(int i = 0; i < static_cast<int>(tasks.size()); ++i)
+      build_node(build_nodes, tasks[i].node_idx, tasks[i].begin, tasks[i].end, tasks[i].depth, 0);
+    build_objects.swap(tree_objects);
+  }
+
+  // Store the nodes in depth-first order without unused slots and, with
+  // blocked leaves, let every leaf start at a whole block of the buffer
+  compact(build_nodes, build_objects, 0, 0);
+  if(block_leaves)
+    triangles.init(tree_objects);
+  references = tree_objects.size() - count(tree_objects.begin(), tree_objects.end(), static_cast<AccObj*>(0));
+  build_cost = sah_cost();
+  if(!cache_file.empty())
+    save_cache();
+}
+
+bool BvhTree::closest_hit(Ray& r, HitInfo& hit) const
+{
+  if(nodes.size() == 0)
+  {
+    closest_plane(r, hit);
+    return hit.has_hit;
+  }
+
+  float3 inv_dir = make_float3(1.0f)/r.direction;
+  unsigned int stack[max_stack];
+  unsigned int stack_size = 0;
+  unsigned int node_idx = 0;
+
+  // The hit info of the closest triangle is filled in after traversal
+  int closest = -1;
+  float closest_beta = 0.0f;
+  float closest_gamma = 0.0f;
+  for(;;)
+  {
+    const BvhNode& node = nodes[node_idx];
+    RT_COUNT(nodes, 1);
+    if(intersect_bbox(node.bbox, r, inv_dir))
+    {
+      if(node.count == 0)
+      {
+        // Visit the child on the near side of the split first
+        if(*(&r.direction.x + node.axis) < 0.0f)
+        {
+          stack[stack_size++] = node_idx + 1;
+          node_idx = node.offset;
+        }
+        else
+        {
+          stack[stack_size++] = node.offset;
+          ++node_idx;
+        }
+        continue;
+      }
+      intersect_leaf(r, hit, node.offset, node.count, closest, closest_beta, closest_gamma);
+    }
+    if(stack_size == 0)
+      break;
+    node_idx = stack[--stack_size];
+  }
+  if(closest >= 0)
+    fill_hit_info(r, hit, closest, closest_beta, closest_gamma);
+  closest_plane(r, hit);
+  return hit.has_hit;
+}
+
+bool BvhTree::any_hit(Ray& r, HitInfo& hit) const
+{
+  if(nodes.size() == 0)
+    return any_plane(r, hit);
+
+  float3 inv_dir = make_float3(1.0f)/r.direction;
+  unsigned int stack[max_stack];
+  unsigned int stack_size = 0;
+  unsigned int node_idx = 0;
+  for(;;)
+  {
+    const BvhNode& node = nodes[node_idx];
+    RT_COUNT(nodes, 1);
+    if(intersect_bbox(node.bbox, r, inv_dir))
+    {
+      if(node.count == 0)
+      {
+        stack[stack_size++] = node.offset;
+        ++node_idx;
+        continue;
+      }
+      if(intersect_leaf_any(r, node.offset, node.count))
+      {
+        hit.has_hit = true;
+        return true;
+      }
+    }
+    if(stack_size == 0)
+      break;
+    node_idx = stack[--stack_size];
+  }
+  return any_plane(r, hit);
+}
+
+void BvhTree::closest_hit_packet(Ray* rays, HitInfo* hits, unsigned int n) const
+{
+  // Packets of rays going in different octants and trees that have
+  // dropped their binary nodes are traced ray by ray
+  if(n == 0 || n > max_packet_size || nodes.size() == 0 || !same_direction_signs(rays, n))
+  {
+    Accelerator::closest_hit_packet(rays, hits, n);
+    return;
+  }
+
+  float3 inv_dir[max_packet_size];
+  int closest[max_packet_size];
+  float closest_beta[max_packet_size];
+  float closest_gamma[max_packet_size];
+  float t_max = 0.0f;
+  PacketInterval packet;
+  for(unsigned int i = 0; i < n; ++i)
+  {
+    inv_dir[i] = make_float3(1.0f)/rays[i].direction;
+    closest[i] = -1;
+    closest_beta[i] = closest_gamma[i] = 0.0f;
+    t_max = fmaxf(t_max, rays[i].tmax);
+    packet.include(rays[i], inv_dir[i]);
+  }
+
+  // Each node is entered with the first ray that hits it. Rays before it
+  // are inactive in the subtree, and the rays after it are only tested
+  // individually if the interval test cannot rule out the whole packet.
+  BvhPacketStackEntry stack[max_stack];
+  unsigned int stack_size = 0;
+  unsigned int node_idx = 0;
+  unsigned int first = 0;
+  for(;;)
+  {
+    const BvhNode& node = nodes[node_idx];
+    RT_COUNT(nodes, 1);
+    bool hit_node = intersect_bbox(node.bbox, rays[first], inv_dir[first]);
+    if(!hit_node && !packet.misses(node.bbox, t_max))
+    {
+      while(++first < n)
+        if(intersect_bbox(node.bbox, rays[first], inv_dir[first]))
+        {
+          hit_node = true;
+          break;
+        }
+    }
+    if(hit_node)
+    {
+      if(node.count == 0)
+      {
+        // All rays agree on the child on the near side of the split
+        stack[stack_size].first = first;
+        if(packet.sign[node.axis])
+        {
+          stack[stack_size++].node = node_idx + 1;
+          node_idx = node.offset;
+        }
+        else
+        {
+          stack[stack_size++].node = node.offset;
+          ++node_idx;
+        }
+        continue;
+      }
+
+      t_max = 0.0f;
+      for(unsigned int i = 0; i < n; ++i)
+      {
+        if(i >= first && intersect_bbox(node.bbox, rays[i], inv_dir[i]))
+          intersect_leaf(rays[i], hits[i], node.offset, node.count, closest[i], closest_beta[i], closest_gamma[i]);
+        t_max = fmaxf(t_max, rays[i].tmax);
+      }
+    }
+    if(stack_size == 0)
+      break;
+    --stack_size;
+    node_idx = stack[stack_size].node;
+    first = stack[stack_size].first;
+  }
+  for(unsigned int i = 0; i < n; ++i)
+  {
+    if(closest[i] >= 0)
+      fill_hit_info(rays[i], hits[i], closest[i], closest_beta[i], closest_gamma[i]);
+    closest_plane(rays[i], hits[i]);
+  }
+}
+
+void BvhTree::refit()
+{
+  if(nodes.size() == 0 || !refit_primitives())
+  {
+    rebuild();
+    return;
+  }
+  if(block_leaves)
+    triangles.init(tree_objects);
+
+  // Children are stored after their parent
+  for(unsigned int i = nodes.size(); i > 0; --i)
+  {
+    BvhNode& node = nodes[i - 1];
+    if(node.count > 0)
+      node.bbox = leaf_bbox(node.offset, node.count);
+    else
+    {
+      node.bbox = nodes[i].bbox;
+      node.bbox.include(nodes[node.offset].bbox);
+    }
+  }
+  if(sah_cost() > max_cost_growth*build_cost)
+    rebuild();
+}
+
+string BvhTree::describe() const
+{
+  ostringstream ostr;
+  ostr << "Bounding volume hierarchy (" << nodes.size() << " nodes, " << leaves << " leaves, ";
+  if(split_budget > 0.0f)
+    ostr << references << " references to " << primitives.size() << " objects, ";
+  ostr << (leaves > 0 ? references/static_cast<float>(leaves) : 0.0f) << " objects per leaf, max depth "
+       << max_depth << ", " << planes.size() << " planes).";
+  return ostr.str();
+}
+
+AccStats BvhTree::get_stats() const
+{
+  AccStats stats;
+  stats.nodes = nodes.size();
+  stats.primitives = primitives.size();
+  stats.sah_cost = sah_cost();
+  if(nodes.size() == 0)
+    return stats;
+
+  // The left child of a node is the next node
+  vector<pair<unsigned int, unsigned int> > stack(1, make_pair(0u, 0u));
+  while(!stack.empty())
+  {
+    unsigned int node_idx = stack.back().first;
+    unsigned int depth = stack.back().second;
+    stack.pop_back();
+    const BvhNode& node = nodes[node_idx];
+    if(node.count > 0)
+      stats.add_leaf(depth, node.count);
+    else
+    {
+      stack.push_back(make_pair(node_idx + 1, depth + 1));
+      stack.push_back(make_pair(node.offset, depth + 1));
+    }
+  }
+  return stats;
+}
+
+void BvhTree::build_node(vector<BvhNode>& build_nodes, unsigned int node_idx, unsigned int begin, unsigned int end,
+                         unsigned int depth, vector<BvhBuildTask>* deferred)
+{
+  unsigned int count = end - begin;
+  if(deferred && count < parallel_threshold)
+  {
+    // Leave small subtrees for the parallel pass
+    BvhBuildTask task = { node_idx, begin, end, depth };
+    deferred->push_back(task);
+    return;
+  }
+
+  Aabb bbox;
+  Aabb centroid_bbox;
+  compute_bounds(begin, end, bbox, centroid_bbox);
+
+  unsigned int middle = begin;
+  unsigned int axis = centroid_bbox.longestAxis();
+
+  // A leaf that fits in one triangle block costs a single block test, so
+  // splitting it further can only add traversal steps
+  if(count > min(max_objects, triangle_block_size))
+  {
+    unsigned int split_bin;
+    if(depth < median_depth && find_split(bbox, centroid_bbox, begin, end, axis, split_bin))
+      middle = partition(centroid_bbox, begin, end, axis, split_bin);
+    else if(count > max_objects)
+    {
+      // Fall back to an object median split along the axis of largest centroid extent
+      middle = begin + count/2;
+      nth_element(tree_objects.begin() + begin, tree_objects.begin() + middle, tree_objects.begin() + end,
+                  CentroidLess(axis));
+    }
+
+    // Guard against splits leaving one side empty due to round-off
+    if(middle == begin || middle == end)
+      middle = count > max_objects ? begin + count/2 : begin;
+  }
+
+  BvhNode& node = build_nodes[node_idx];
+  node.bbox = bbox;
+  if(middle == begin)
+  {
+    node.offset = begin;
+    node.count = static_cast<unsigned short>(count);
+    node.axis = 0;
+  }
+  else
+  {
+    node.count = 0;
+    node.axis = static_cast<unsigned short>(axis);
+
+    // Node slots are reserved such that indices do not depend on the order in which
+    // subtrees are built: a subtree over n objects has at most 2n - 1 nodes.
+    node.offset = node_idx + 2*(middle - begin);
+    build_node(build_nodes, node_idx + 1, begin, middle, depth + 1, deferred);
+    build_node(build_nodes, node.offset, middle, end, depth + 1, deferred);
+  }
+}
+
+void BvhTree::compact(const vector<BvhNode>& build_nodes, const vector<AccObj*>& build_objects,
+                      unsigned int node_idx, unsigned int depth)
+{
+  const BvhNode& node = build_nodes[node_idx];
+  unsigned int idx = nodes.size();
+  nodes.push_back(node);
+  max_depth = std::max(max_depth, depth);
+  if(node.count > 0)
+  {
+    nodes[idx].offset = tree_objects.size();
+    tree_objects.insert(tree_objects.end(), build_objects.begin() + node.offset, build_objects.begin() + node.offset + node.count);
+    if(block_leaves)
+      tree_objects.resize(nodes[idx].offset + TriangleBuffer::padded_size(node.count), 0);
+    ++leaves;
+    return;
+  }
+  compact(build_nodes, build_objects, node_idx + 1, depth + 1);
+  nodes[idx].offset = nodes.size();
+  compact(build_nodes, build_objects, node.offset, depth + 1);
+}
+
+void BvhTree::compute_bounds(unsigned int begin, unsigned int end, Aabb& bbox, Aabb& centroid_bbox) const
+{
+  unsigned int count = end - begin;
+  if(count < parallel_threshold)
+  {
+    for(unsigned int i = begin; i < end; ++i)
+    {
+      const AccObj* obj = tree_objects[i];
+      bbox.include(obj->bbox);
+      centroid_bbox.include(obj->bbox.center());
+    }
+    return;
+  }
+
+  // Compute the bounds of blocks of objects in parallel. The result does not
+  // depend on the number of threads as it only takes minima and maxima.
+  const int blocks = static_cast<int>(partition_blocks);
+  unsigned int block_size = (count + blocks - 1)/blocks;
+  vector<Aabb> block_bbox(blocks);
+  vector<Aabb> block_centroid_bbox(blocks);
+  #pragma omp parallel for
+  for(int b = 0; b < blocks; ++b)
+  {
+    unsigned int block_begin = std::min(end, begin + b*block_size);
+    unsigned int block_end = std::min(end, begin + (b + 1)*block_size);
+    compute_bounds(block_begin, block_end, block_bbox[b], block_centroid_bbox[b]);
+  }
+  for(int b = 0; b < blocks; ++b)
+  {
+    bbox.include(block_bbox[b]);
+    centroid_bbox.include(block_centroid_bbox[b]);
+  }
+}
+
+void BvhTree::bin_objects(unsigned int begin, unsigned int end, const float* c_min, const float* k,
+                          Aabb* bin_bbox, unsigned int* bin_count) const
+{
+  for(unsigned int j = begin; j < end; ++j)
+  {
+    const AccObj* obj = tree_objects[j];
+    for(unsigned int i = 0; i < 3; ++i)
+    {
+      unsigned int b = i*bins + bin_index(centroid(obj, i), c_min[i], k[i], bins);
+      bin_bbox[b].include(obj->bbox);
+      ++bin_count[b];
+    }
+  }
+}
+
+bool BvhTree::find_split(const Aabb& bbox, const Aabb& centroid_bbox, unsigned int begin, unsigned int end,
+                         unsigned int& axis, unsigned int& split_bin) const
+{
+  unsigned int count = end - begin;
+  float half_area = bbox.halfArea();
+  float inv_area = half_area > 0.0f ? 1.0f/half_area : 0.0f;
+
+  // Bin the objects according to their centroids along all three axes
+  float c_min[3];
+  float k[3];
+  for(unsigned int i = 0; i < 3; ++i)
+  {
+    c_min[i] = *(&centroid_bbox.m_min.x + i);
+    float extent = *(&centroid_bbox.m_max.x + i) - c_min[i];
+    k[i] = extent > 0.0f ? bins*(1.0f - f_eps)/extent : 0.0f;
+  }
+  vector<Aabb> bin_bbox(3*bins);
+  vector<unsigned int> bin_count(3*bins, 0);
+  if(count < parallel_threshold)
+    bin_objects(begin, end, c_min, k, &bin_bbox[0], &bin_count[0]);
+  else
+  {
+    // Bin blocks of objects in parallel and merge the bins afterwards
+    const int blocks = static_cast<int>(partition_blocks);
+    unsigned int block_size = (count + blocks - 1)/blocks;
+    vector<Aabb> block_bin_bbox(blocks*3*bins);
+    vector<unsigned int> block_bin_count(blocks*3*bins, 0);
+    #pragma omp parallel for
+    for(int b = 0; b < blocks; ++b)
+    {
+      unsigned int block_begin = std::min(end, begin + b*block_size);
+      unsigned int block_end = std::min(end, begin + (b + 1)*block_size);
+      bin_objects(block_begin, block_end, c_min, k, &block_bin_bbox[b*3*bins], &block_bin_count[b*3*bins]);
+    }
+    for(int b = 0; b < blocks; ++b)
+      for(unsigned int i = 0; i < 3*bins; ++i)
+      {
+        bin_bbox[i].include(block_bin_bbox[b*3*bins + i]);
+        bin_count[i] += block_bin_count[b*3*bins + i];
+      }
+  }
+
+  // A split is only accepted if it is cheaper than making a leaf, unless
+  // there are too many objects to make a leaf.
+  float min_cost = count > max_objects ? 1.0e27f : leaf_cost(count);
+  bool found = false;
+  vector<float> right_cost(bins);
+  for(unsigned int i = 0; i < 3; ++i)
+  {
+    if(k[i] == 0.0f)
+      continue;
+
+    // Sweep from the right to get the cost of all right-hand sides
+    const Aabb* axis_bbox = &bin_bbox[i*bins];
+    const unsigned int* axis_count = &bin_count[i*bins];
+    Aabb right_bbox;
+    unsigned int right_count = 0;
+    for(unsigned int b = bins - 1; b > 0; --b)
+    {
+      right_bbox.include(axis_bbox[b]);
+      right_count += axis_count[b];
+      right_cost[b - 1] = right_count > 0 ? leaf_cost(right_count)*right_bbox.halfArea() : 0.0f;
+    }
+
+    // Sweep from the left and evaluate the surface area heuristic
+    Aabb left_bbox;
+    unsigned int left_count = 0;
+    for(unsigned int b = 0; b < bins - 1; ++b)
+    {
+      left_bbox.include(axis_bbox[b]);
+      left_count += axis_count[b];
+      if(left_count == 0 || left_count == count)
+        continue;
+      float cost = traversal_cost + (leaf_cost(left_count)*left_bbox.halfArea() + right_cost[b])*inv_area;
+      if(cost < min_cost)
+      {
+        min_cost = cost;
+        axis = i;
+        split_bin = b;
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+unsigned int BvhTree::partition(const Aabb& centroid_bbox, unsigned int begin, unsigned int end, unsigned int axis, unsigned int split_bin)
+{
+  float c_min = *(&centroid_bbox.m_min.x + axis);
+  float extent = *(&centroid_bbox.m_max.x + axis) - c_min;
+  LeftOfSplit is_left(axis, c_min, bins*(1.0f - f_eps)/extent, bins, split_bin);
+  unsigned int count = end - begin;
+  if(count < parallel_threshold)
+    return stable_partition(tree_objects.begin() + begin, tree_objects.begin() + end, is_left) - tree_objects.begin();
+
+  // Parallel stable partition: count the objects going left in each block of
+  // objects, then scatter the blocks to their offsets in the partitioned array.
+  const int blocks = static_cast<int>(partition_blocks);
+  unsigned int block_size = (count + blocks - 1)/blocks;
+  vector<unsigned int> left_count(blocks, 0);
+  #pragma omp parallel for
+  for(int b = 0; b < blocks; ++b)
+  {
+    unsigned int block_end = std::min(end, begin + (b + 1)*block_size);
+    for(unsigned int i = begin + b*block_size; i < block_end; ++i)
+      left_count[b] += is_left(tree_objects[i]);
+  }
+  vector<unsigned int> left_offset(blocks);
+  vector<unsigned int> right_offset(blocks);
+  unsigned int total_left = 0;
+  for(int b = 0; b < blocks; ++b)
+  {
+    left_offset[b] = total_left;
+    total_left += left_count[b];
+  }
+  unsigned int total_right = total_left;
+  for(int b = 0; b < blocks; ++b)
+  {
+    right_offset[b] = total_right;
+    unsigned int block_begin = std::min(count, b*block_size);
+    unsigned int block_end = std::min(count, (b + 1)*block_size);
+    total_right += block_end - block_begin - left_count[b];
+  }
+  vector<AccObj*> partitioned(count);
+  #pragma omp parallel for
+  for(int b = 0; b < blocks; ++b)
+  {
+    unsigned int l = left_offset[b];
+    unsigned int r = right_offset[b];
+    unsigned int block_end = std::min(end, begin + (b + 1)*block_size);
+    for(unsigned int i = begin + b*block_size; i < block_end; ++i)
+    {
+      AccObj* obj = tree_objects[i];
+      if(is_left(obj))
+        partitioned[l++] = obj;
+      else
+        partitioned[r++] = obj;
+    }
+  }
+  copy(partitioned.begin(), partitioned.end(), tree_objects.begin() + begin);
+  return begin + total_left;
+}
+
+void BvhTree::build_spatial(vector<BvhNode>& build_nodes, vector<AccObj*>& build_objects, vector<BvhReference>& refs,
+                            float root_area, unsigned int depth, unsigned int budget) const
+{
+  unsigned int count = refs.size();
+  Aabb bbox;
+  Aabb centroid_bbox;
+  for(unsigned int i = 0; i < count; ++i)
+  {
+    bbox.include(refs[i].bbox);
+    centroid_bbox.include(refs[i].bbox.center());
+  }
+
+  vector<BvhReference> left;
+  vector<BvhReference> right;
+  unsigned int axis = centroid_bbox.longestAxis();
+  if(count > min(max_objects, triangle_block_size))
+  {
+    unsigned int split_bin = 0;
+    float min_cost = count > max_objects ? 1.0e27f : leaf_cost(count);
+    Aabb overlap;
+    bool object_split = depth < median_depth && find_object_split(bbox, centroid_bbox, refs, axis, split_bin, min_cost, overlap);
+
+    // Try a spatial split if the children of the best object split overlap
+    // noticeably or if no object split separates the references
+    float position = 0.0f;
+    unsigned int spatial_axis = axis;
+    bool spatial_split = depth < median_depth && budget > 0
+                         && (!object_split || (overlap.valid() && overlap.halfArea() > overlap_threshold*root_area))
+                         && find_spatial_split(bbox, refs, budget, spatial_axis, position, min_cost);
+    if(spatial_split)
+    {
+      axis = spatial_axis;
+      for(unsigned int i = 0; i < count; ++i)
+      {
+        const BvhReference& ref = refs[i];
+        float ref_min = *(&ref.bbox.m_min.x + axis);
+        float ref_max = *(&ref.bbox.m_max.x + axis);
+        if(ref_max <= position)
+          left.push_back(ref);
+        else if(ref_min >= position)
+          right.push_back(ref);
+        else if(budget == 0)
+          (ref.bbox.center(axis) < position ? left : right).push_back(ref);
+        else
+        {
+          // Reference the object from both sides of the split plane
+          BvhReference part = ref;
+          part.bbox = clip_reference(ref, axis, ref_min, position);
+          if(part.bbox.valid())
+            left.push_back(part);
+          part.bbox = clip_reference(ref, axis, position, ref_max);
+          if(part.bbox.valid())
+            right.push_back(part);
+          --budget;
+        }
+      }
+    }
+    else if(object_split)
+    {
+      float c_min = *(&centroid_bbox.m_min.x + axis);
+      float k = bins*(1.0f - f_eps)/(*(&centroid_bbox.m_max.x + axis) - c_min);
+      for(unsigned int i = 0; i < count; ++i)
+        (bin_index(refs[i].bbox.center(axis), c_min, k, bins) <= split_bin ? left : right).push_back(refs[i]);
+    }
+    else if(count > max_objects)
+    {
+      // Fall back to an object median split along the axis of largest centroid extent
+      nth_element(refs.begin(), refs.begin() + count/2, refs.end(), ReferenceCentroidLess(axis));
+      left.assign(refs.begin(), refs.begin() + count/2);
+      right.assign(refs.begin() + count/2, refs.end());
+    }
+
+    // Guard against splits leaving one side empty due to round-off
+    if(left.empty() || right.empty())
+    {
+      left.clear();
+      right.clear();
+      if(count > max_objects)
+      {
+        nth_element(refs.begin(), refs.begin() + count/2, refs.end(), ReferenceCentroidLess(axis));
+        left.assign(refs.begin(), refs.begin() + count/2);
+        right.assign(refs.begin() + count/2, refs.end());
+      }
+    }
+  }
+
+  unsigned int node_idx = build_nodes.size();
+  build_nodes.push_back(BvhNode());
+  build_nodes[node_idx].bbox = bbox;
+  if(left.empty())
+  {
+    build_nodes[node_idx].offset = build_objects.size();
+    build_nodes[node_idx].count = static_cast<unsigned short>(count);
+    build_nodes[node_idx].axis = 0;
+    for(unsigned int i = 0; i < count; ++i)
+      build_objects.push_back(refs[i].obj);
+    return;
+  }
+
+  // The left child is the next node and the right child follows its subtree
+  build_nodes[node_idx].count = 0;
+  build_nodes[node_idx].axis = static_cast<unsigned short>(axis);
+  vector<BvhReference>().swap(refs);
+
+  // Share the remaining duplication budget in proportion to the number of
+  // references, so that the top levels cannot use it all up
+  unsigned int left_budget = static_cast<unsigned int>(static_cast<double>(budget)*left.size()/(left.size() + right.size()));
+  build_spatial(build_nodes, build_objects, left, root_area, depth + 1, left_budget);
+  build_nodes[node_idx].offset = build_nodes.size();
+  build_spatial(build_nodes, build_objects, right, root_area, depth + 1, budget - left_budget);
+}
+
+bool BvhTree::find_object_split(const Aabb& bbox, const Aabb& centroid_bbox, const vector<BvhReference>& refs,
+                                unsigned int& axis, unsigned int& split_bin, float& min_cost, Aabb& overlap) const
+{
+  unsigned int count = refs.size();
+  float half_area = bbox.halfArea();
+  float inv_area = half_area > 0.0f ? 1.0f/half_area : 0.0f;
+
+  // Same binning as find_split(...), but on the bounds of the references
+  bool found = false;
+  vector<Aabb> bin_bbox(bins);
+  vector<unsigned int> bin_count(bins);
+  vector<Aabb> right_bbox(bins);
+  vector<float> right_cost(bins);
+  for(unsigned int i = 0; i < 3; ++i)
+  {
+    float c_min = *(&centroid_bbox.m_min.x + i);
+    float extent = *(&centroid_bbox.m_max.x + i) - c_min;
+    if(extent <= 0.0f)
+      continue;
+    float k = bins*(1.0f - f_eps)/extent;
+    fill(bin_bbox.begin(), bin_bbox.end(), Aabb());
+    fill(bin_count.begin(), bin_count.end(), 0);
+    for(unsigned int j = 0; j < count; ++j)
+    {
+      unsigned int b = bin_index(refs[j].bbox.center(i), c_min, k, bins);
+      bin_bbox[b].include(refs[j].bbox);
+      ++bin_count[b];
+    }
+
+    Aabb right;
+    unsigned int right_count = 0;
+    for(unsigned int b = bins - 1; b > 0; --b)
+    {
+      right.include(bin_bbox[b]);
+      right_count += bin_count[b];
+      right_bbox[b - 1] = right;
+      right_cost[b - 1] = right_count > 0 ? leaf_cost(right_count)*right.halfArea() : 0.0f;
+    }
+
+    Aabb left;
+    unsigned int left_count = 0;
+    for(unsigned int b = 0; b < bins - 1; ++b)
+    {
+      left.include(bin_bbox[b]);
+      left_count += bin_count[b];
+      if(left_count == 0 || left_count == count)
+        continue;
+      float cost = traversal_cost + (leaf_cost(left_count)*left.halfArea() + right_cost[b])*inv_area;
+      if(cost < min_cost)
+      {
+        min_cost = cost;
+        axis = i;
+        split_bin = b;
+        overlap = left;
+        overlap.intersection(right_bbox[b]);
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+bool BvhTree::find_spatial_split(const Aabb& bbox, const vector<BvhReference>& refs, unsigned int budget,
+                                 unsigned int& axis, float& position, float& min_cost) const
+{
+  unsigned int count = refs.size();
+  float half_area = bbox.halfArea();
+  float inv_area = half_area > 0.0f ? 1.0f/half_area : 0.0f;
+
+  // Bin the clipped references into slabs of equal width. A reference is
+  // counted where it enters and where it exits the range of slabs it spans.
+  bool found = false;
+  vector<Aabb> bin_bbox(bins);
+  vector<unsigned int> entry_count(bins);
+  vector<unsigned int> exit_count(bins);
+  vector<unsigned int> right_count(bins);
+  vector<float> right_cost(bins);
+  for(unsigned int i = 0; i < 3; ++i)
+  {
+    float lo = *(&bbox.m_min.x + i);
+    float extent = *(&bbox.m_max.x + i) - lo;
+    if(extent <= 0.0f)
+      continue;
+    float k = bins*(1.0f - f_eps)/extent;
+    float width = extent/bins;
+    fill(bin_bbox.begin(), bin_bbox.end(), Aabb());
+    fill(entry_count.begin(), entry_count.end(), 0);
+    fill(exit_count.begin(), exit_count.end(), 0);
+    for(unsigned int j = 0; j < count; ++j)
+    {
+      const BvhReference& ref = refs[j];
+      unsigned int first = bin_index(*(&ref.bbox.m_min.x + i), lo, k, bins);
+      unsigned int last = bin_index(*(&ref.bbox.m_max.x + i), lo, k, bins);
+      if(first == last)
+        bin_bbox[first].include(ref.bbox);
+      else
+        for(unsigned int b = first; b <= last; ++b)
+          bin_bbox[b].include(clip_reference(ref, i, lo + b*width, lo + (b + 1)*width));
+      ++entry_count[first];
+      ++exit_count[last];
+    }
+
+    Aabb right;
+    unsigned int right_refs = 0;
+    for(unsigned int b = bins - 1; b > 0; --b)
+    {
+      right.include(bin_bbox[b]);
+      right_refs += exit_count[b];
+      right_count[b - 1] = right_refs;
+      right_cost[b - 1] = right_refs > 0 ? leaf_cost(right_refs)*right.halfArea() : 0.0f;
+    }
+
+    Aabb left;
+    unsigned int left_refs = 0;
+    for(unsigned int b = 0; b < bins - 1; ++b)
+    {
+      left.include(bin_bbox[b]);
+      left_refs += entry_count[b];
+      if(left_refs == 0 || right_count[b] == 0 || left_refs + right_count[b] > count + budget)
+        continue;
+      float cost = traversal_cost + (leaf_cost(left_refs)*left.halfArea() + right_cost[b])*inv_area;
+      if(cost < min_cost)
+      {
+        min_cost = cost;
+        axis = i;
+        position = lo + (b + 1)*width;
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+void BvhTree::intersect_leaf(Ray& r, HitInfo& hit, unsigned int first, unsigned int count,
+                             int& closest, float& closest_beta, float& closest_gamma) const
+{
+  RT_COUNT(primitives, count);
+  float t, beta, gamma;
+  int tri = triangles.intersect(r, first, count, t, beta, gamma);
+  if(tri >= 0)
+  {
+    r.tmax = t;
+    closest = tri;
+    closest_beta = beta;
+    closest_gamma = gamma;
+  }
+  if(!triangles.only_triangles())
+  {
+    for(unsigned int i = first; i < first + count; ++i)
+    {
+      const AccObj* obj = tree_objects[i];
+      if(!triangles.is_triangle(i) && obj->geometry->intersect(r, hit, obj->prim_idx))
+      {
+        r.tmax = hit.dist;
+        closest = -1;
+      }
+    }
+  }
+}
+
+bool BvhTree::intersect_leaf_any(const Ray& r, unsigned int first, unsigned int count) const
+{
+  RT_COUNT(primitives, count);
+  if(triangles.intersect_any(r, first, count))
+    return true;
+  if(!triangles.only_triangles())
+  {
+    for(unsigned int i = first; i < first + count; ++i)
+    {
+      const AccObj* obj = tree_objects[i];
+      if(!triangles.is_triangle(i) && obj->geometry->intersect_any(r, obj->prim_idx))
+        return true;
+    }
+  }
+  return false;
+}
+
+void BvhTree::fill_hit_info(const Ray& r, HitInfo& hit, int closest, float beta, float gamma) const
+{
+  const AccObj* obj = tree_objects[closest];
+  obj->geometry->fill_hit_info(r, hit, obj->prim_idx, r.tmax, beta, gamma);
+}
+
+bool BvhTree::load_cache()
+{
+  ifstream ifs(cache_file.c_str(), ifstream::binary);
+  BvhCacheHeader header;
+  if(!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    return false;
+  if(!equal(cache_magic, cache_magic + 4, header.magic) || header.version != cache_version
+     || header.hash != primitive_hash() || header.max_objects != max_objects
+     || header.block_leaves != static_cast<unsigned int>(block_leaves) || header.bins != bins || header.split_budget != split_budget
+     || header.no_of_primitives != primitives.size() || header.no_of_nodes == 0)
+    return false;
+
+  // Read the nodes and the primitive indices of the leaf objects, -1 for padding
+  vector<BvhNode> cached_nodes(header.no_of_nodes);
+  vector<int> object_idx(header.no_of_objects);
+  if(!ifs.read(reinterpret_cast<char*>(&cached_nodes[0]), header.no_of_nodes*sizeof(BvhNode)))
+    return false;
+  if(header.no_of_objects > 0 && !ifs.read(reinterpret_cast<char*>(&object_idx[0]), header.no_of_objects*sizeof(int)))
+    return false;
+
+  // Reject files that could make traversal read out of range or loop:
+  // interior nodes need both children after them, and leaves need count
+  // objects, padded to whole blocks of triangles if leaves are blocked
+  for(unsigned int i = 0; i < object_idx.size(); ++i)
+    if(object_idx[i] < -1 || object_idx[i] >= static_cast<int>(primitives.size()))
+      return false;
+  for(unsigned int i = 0; i < cached_nodes.size(); ++i)
+  {
+    const BvhNode& node = cached_nodes[i];
+    if(node.count == 0)
+    {
+      if(i + 1 >= cached_nodes.size() || node.offset <= i + 1 || node.offset >= cached_nodes.size() || node.axis > 2)
+        return false;
+    }
+    else
+    {
+      unsigned int size = block_leaves ? TriangleBuffer::padded_size(node.count) : node.count;
+      if((block_leaves && node.offset%triangle_block_size != 0) || node.offset + size > object_idx.size())
+        return false;
+      for(unsigned int j = node.offset; j < node.offset + node.count; ++j)
+        if(object_idx[j] < 0)
+          return false;
+    }
+  }
+
+  nodes.swap(cached_nodes);
+  tree_objects.resize(object_idx.size());
+  for(unsigned int i = 0; i < object_idx.size(); ++i)
+    tree_objects[i] = object_idx[i] < 0 ? 0 : primitives[object_idx[i]];
+  leaves = header.leaves;
+  max_depth = header.max_depth;
+  build_cost = header.build_cost;
+  references = tree_objects.size() - count(object_idx.begin(), object_idx.end(), -1);
+  if(block_leaves)
+    triangles.init(tree_objects);
+  cout << "Loaded bounding volume hierarchy from " << cache_file << endl;
+  return true;
+}
+
+void BvhTree::save_cache() const
+{
+  map<const AccObj*, int> primitive_idx;
+  for(unsigned int i = 0; i < primitives.size(); ++i)
+    primitive_idx[primitives[i]] = i;
+  vector<int> object_idx(tree_objects.size());
+  for(unsigned int i = 0; i < tree_objects.size(); ++i)
+    object_idx[i] = tree_objects[i] ? primitive_idx[tree_objects[i]] : -1;
+
+  BvhCacheHeader header;
+  copy(cache_magic, cache_magic + 4, header.magic);
+  header.version = cache_version;
+  header.hash = primitive_hash();
+  header.max_objects = max_objects;
+  header.block_leaves = block_leaves;
+  header.bins = bins;
+  header.no_of_primitives = primitives.size();
+  header.no_of_nodes = nodes.size();
+  header.no_of_objects = object_idx.size();
+  header.leaves = leaves;
+  header.max_depth = max_depth;
+  header.build_cost = build_cost;
+  header.split_budget = split_budget;
+
+  // Write to a file of this process and move it into place, so renders
+  // running side by side never read a partly written cache
+  ostringstream tmp_name;
+  tmp_name << cache_file << "." << getpid() << ".tmp";
+  string tmp_file = tmp_name.str();
+  {
+    ofstream ofs(tmp_file.c_str(), ofstream::binary);
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char*>(&nodes[0]), nodes.size()*sizeof(BvhNode));
+    if(object_idx.size() > 0)
+      ofs.write(reinterpret_cast<const char*>(&object_idx[0]), object_idx.size()*sizeof(int));
+    ofs.close();
+    if(!ofs)
+    {
+      cerr << "Could not write bounding volume hierarchy to " << tmp_file << endl;
+      remove(tmp_file.c_str());
+      return;
+    }
+  }
+#ifdef _MSC_VER
+  // Renaming does not replace an existing file on Windows
+  remove(cache_file.c_str());
+#endif
+  if(rename(tmp_file.c_str(), cache_file.c_str()) != 0)
+  {
+    cerr << "Could not write bounding volume hierarchy to " << cache_file << endl;
+    remove(tmp_file.c_str());
+  }
+}
+
+Aabb BvhTree::leaf_bbox(unsigned int first, unsigned int count) const
+{
+  Aabb bbox;
+  for(unsigned int i = first; i < first + count; ++i)
+    bbox.include(tree_objects[i]->bbox);
+  return bbox;
+}
+
+float BvhTree::sah_cost() const
+{
+  // Expected cost of tracing a ray through the tree relative to the
+  // surface area of the root
+  float cost = 0.0f;
+  for(unsigned int i = 0; i < nodes.size(); ++i)
+  {
+    const BvhNode& node = nodes[i];
+    cost += node.bbox.area()*(node.count > 0 ? leaf_cost(node.count) : traversal_cost);
+  }
+  float root_area = nodes.size() > 0 ? nodes[0].bbox.area() : 0.0f;
+  return root_area > 0.0f ? cost/root_area : cost;
+}
+
+bool BvhTree::intersect_bbox(const Aabb& bbox, const Ray& r, const float3& inv_dir) const
+{
+  float3 p1 = (bbox.m_min - r.origin)*inv_dir;
+  float3 p2 = (bbox.m_max - r.origin)*inv_dir;
+  float tmin = fmaxf(fminf(p1, p2));
+  float tmax = fminf(fmaxf(p1, p2));
+  return tmin <= tmax && tmin <= r.tmax && tmax >= r.tmin;
+}
@@ -0,0 +1,126 @@
+// 02562 Rendering Framework
+// Bounding volume hierarchy with binned SAH splits
+// [Wald, IEEE Symposium on Interactive Ray Tracing 2007].
+// Copyright (c) DTU Informatics 2011
+
+#ifndef BVHTREE_H
+#define BVHTREE_H
+
+#include <vector>
+#include <string>
+#include <optix_world.h>
+#include "AccObj.h"
+#include "Object3D.h"
+#include "Plane.h"
+#include "HitInfo.h"
+#include "Accelerator.h"
+#include "TriangleBuffer.h"
+
+struct BvhNode
+{
+  optix::Aabb bbox;
+  unsigned int offset;   // index of first object if leaf, index of right child otherwise
+  unsigned short count;  // number of objects in a leaf, 0 for interior nodes
+  unsigned short axis;   // split axis of an interior node (the left child is the next node)
+};
+
+struct BvhBuildTask
+{
+  unsigned int node_idx;
+  unsigned int begin;
+  unsigned int end;
+  unsigned int depth;
+};
+
+// Reference to an object in a build with spatial splits. An object
+// straddling a spatial split is referenced from both children, each
+// reference bounding the part of the object on its side of the split.
+struct BvhReference
+{
+  AccObj* obj;
+  optix::Aabb bbox;
+};
+
+class BvhTree : public Accelerator
+{
+public:
+  BvhTree(unsigned int max_objects_in_leaf = 4, unsigned int no_of_bins = 16)
+    : max_objects(max_objects_in_leaf), block_leaves(true), bins(no_of_bins), leaves(0), max_depth(0),
+      build_cost(0.0f), max_cost_growth(1.5f), split_budget(0.0f), references(0)
+  { }
+
+  virtual void init(const std::vector<Object3D*>& geometry, const std::vector<const Plane*>& planes);
+  virtual bool closest_hit(optix::Ray& r, HitInfo& hit) const;
+  virtual bool any_hit(optix::Ray& r, HitInfo& hit) const;
+  virtual void closest_hit_packet(optix::Ray* rays, HitInfo* hits, unsigned int n) const;
+  virtual std::string describe() const;
+  virtual AccStats get_stats() const;
+
+  // Refits the node bounds bottom-up and rebuilds the tree if its SAH cost
+  // has grown by more than the given factor since it was built
+  virtual void refit();
+  void set_max_cost_growth(float growth) { max_cost_growth = growth; }
+
+  // Spatial splits [Stich et al., High Performance Graphics 2009] clip the
+  // bounds of objects against the split plane where that lowers the SAH
+  // cost, which helps with long, thin triangles. The budget is the number
+  // of extra references allowed as a fraction of the number of objects,
+  // zero gives object splits only. Takes effect at the next init(...).
+  void set_spatial_splits(float budget) { split_budget = budget; }
+
+  unsigned int get_no_of_nodes() const { return nodes.size(); }
+  unsigned int get_no_of_leaves() const { return leaves; }
+  unsigned int get_max_depth() const { return max_depth; }
+  unsigned int get_no_of_references() const { return references; }
+
+protected:
+  // Leaf tests shared by the traversal loops. The hit info of the closest
+  // triangle is left to fill_hit_info(...) once traversal is done.
+  void intersect_leaf(optix::Ray& r, HitInfo& hit, unsigned int first, unsigned int count,
+                      int& closest, float& closest_beta, float& closest_gamma) const;
+  bool intersect_leaf_any(const optix::Ray& r, unsigned int first, unsigned int count) const;
+  void fill_hit_info(const optix::Ray& r, HitInfo& hit, int closest, float beta, float gamma) const;
+  optix::Aabb leaf_bbox(unsigned int first, unsigned int count) const;
+
+private:
+  void build_node(std::vector<BvhNode>& build_nodes, unsigned int node_idx, unsigned int begin, unsigned int end,
+                  unsigned int depth, std::vector<BvhBuildTask>* deferred);
+  void compact(const std::vector<BvhNode>& build_nodes, const std::vector<AccObj*>& build_objects,
+               unsigned int node_idx, unsigned int depth);
+  void compute_bounds(unsigned int begin, unsigned int end, optix::Aabb& bbox, optix::Aabb& centroid_bbox) const;
+  void bin_objects(unsigned int begin, unsigned int end, const float* c_min, const float* k,
+                   optix::Aabb* bin_bbox, unsigned int* bin_count) const;
+  bool find_split(const optix::Aabb& bbox, const optix::Aabb& centroid_bbox, unsigned int begin, unsigned int end,
+                  unsigned int& axis, unsigned int& split_bin) const;
+  unsigned int partition(const optix::Aabb& centroid_bbox, unsigned int begin, unsigned int end, unsigned int axis, unsigned int split_bin);
+  void build_spatial(std::vector<BvhNode>& build_nodes, std::vector<AccObj*>& build_objects,
+                     std::vector<BvhReference>& refs, float root_area, unsigned int depth, unsigned int budget) const;
+  bool find_object_split(const optix::Aabb& bbox, const optix::Aabb& centroid_bbox, const std::vector<BvhReference>& refs,
+                         unsigned int& axis, unsigned int& split_bin, float& min_cost, optix::Aabb& overlap) const;
+  bool find_spatial_split(const optix::Aabb& bbox, const std::vector<BvhReference>& refs, unsigned int budget,
+                          unsigned int& axis, float& position, float& min_cost) const;
+  bool intersect_bbox(const optix::Aabb& bbox, const optix::Ray& r, const optix::float3& inv_dir) const;
+  float sah_cost() const;
+  bool load_cache();
+  void save_cache() const;
+
+protected:
+  std::vector<BvhNode> nodes;
+  std::vector<AccObj*> tree_objects;
+  TriangleBuffer triangles;
+  unsigned int max_objects;
+
+  // Leaves start at a whole block of the triangle buffer and are padded
+  // to whole blocks. Derived trees that do not intersect leaves through
+  // the triangle buffer clear it, which also skips building the buffer.
+  bool block_leaves;
+  unsigned int bins;
+  unsigned int leaves;
+  unsigned int max_depth;
+  float build_cost;
+  float max_cost_growth;
+  float split_budget;
+  unsigned int references;
+};
+
+#endif // BVHTREE_H
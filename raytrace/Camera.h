@@ -40,6 +40,15 @@ public:
 
   float get_fov() const { return fov; }
   float get_cam_const() const { return cam_const; }
+
+  /// Check whether another camera has the same view of the scene.
+  bool same_view(const Camera& other) const
+  {
+    return eye.x == other.eye.x && eye.y == other.eye.y && eye.z == other.eye.z
+        && lookat.x == other.lookat.x && lookat.y == other.lookat.y && lookat.z == other.lookat.z
+        && up.x == other.up.x && up.y == other.up.y && up.z == other.up.z
+        && cam_const == other.cam_const;
+  }
   void set_cam_const(float camera_constant) { set(eye, lookat, up, camera_constant); }
 
   // OpenGL
@@ -0,0 +1,345 @@
+// 02562 Rendering Framework
+// Bounding volume hierarchy with child bounds quantized relative to the
+// bounds of their parent [Mahovsky, PhD thesis, University of Calgary 2005].
+// Copyright (c) DTU Informatics 2011
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <map>
+#include <limits>
+#include <algorithm>
+#include <optix_world.h>
+#include "AccObj.h"
+#include "HitInfo.h"
+#include "Triangle.h"
+#include "CompressedBvhTree.h"
+
+using namespace std;
+using namespace optix;
+
+namespace
+{
+  // Visiting a node pops one entry and pushes two, and the binary build
+  // bounds the depth of the tree to 32 levels plus median splits.
+  const unsigned int max_stack = 128;
+
+  // Children are tested before they are pushed, so the stack only holds
+  // nodes hit by the ray. Their bounds are not kept in an Aabb, which
+  // would be initialized for every entry of the stack.
+  struct CompressedBvhStackEntry
+  {
+    unsigned int child;
+    unsigned int count;
+    float3 bbox_min;
+    float3 bbox_max;
+  };
+
+  // Same slab test as BvhTree::intersect_bbox(...)
+  inline bool intersect_bounds(const float3& bbox_min, const float3& bbox_max, const Ray& r, const float3& inv_dir)
+  {
+    float3 p1 = (bbox_min - r.origin)*inv_dir;
+    float3 p2 = (bbox_max - r.origin)*inv_dir;
+    float tmin = fmaxf(fminf(p1, p2));
+    float tmax = fminf(fmaxf(p1, p2));
+    return tmin <= tmax && tmin <= r.tmax && tmax >= r.tmin;
+  }
+
+  // The largest value selects the upper bound of the parent exactly, so
+  // that the children of a node can always be bounded conservatively
+  template<class T>
+  inline float dequantize(T q, float lo, float hi)
+  {
+    const T levels = numeric_limits<T>::max();
+    return q == levels ? hi : lo + q*((hi - lo)*(1.0f/levels));
+  }
+
+  template<class T>
+  inline void dequantize_bbox(const T q[2][3], const float3& parent_min, const float3& parent_max,
+                              float3& bbox_min, float3& bbox_max)
+  {
+    bbox_min = make_float3(dequantize(q[0][0], parent_min.x, parent_max.x),
+                           dequantize(q[0][1], parent_min.y, parent_max.y),
+                           dequantize(q[0][2], parent_min.z, parent_max.z));
+    bbox_max = make_float3(dequantize(q[1][0], parent_min.x, parent_max.x),
+                           dequantize(q[1][1], parent_min.y, parent_max.y),
+                           dequantize(q[1][2], parent_min.z, parent_max.z));
+  }
+
+  template<class T>
+  void quantize_bbox(const Aabb& bbox, const Aabb& parent, T q[2][3])
+  {
+    const T levels = numeric_limits<T>::max();
+    for(unsigned int a = 0; a < 3; ++a)
+    {
+      float lo = *(&parent.m_min.x + a);
+      float hi = *(&parent.m_max.x + a);
+      float b_min = *(&bbox.m_min.x + a);
+      float b_max = *(&bbox.m_max.x + a);
+      float scale = hi > lo ? levels/(hi - lo) : 0.0f;
+      T q_min = static_cast<T>(fminf(fmaxf(floorf((b_min - lo)*scale), 0.0f), levels));
+      T q_max = static_cast<T>(fminf(fmaxf(ceilf((b_max - lo)*scale), 0.0f), levels));
+
+      // Round outwards until the dequantized bounds contain the box
+      while(q_min > 0 && dequantize(q_min, lo, hi) > b_min)
+        --q_min;
+      while(q_max < levels && dequantize(q_max, lo, hi) < b_max)
+        ++q_max;
+      q[0][a] = q_min;
+      q[1][a] = q_max;
+    }
+  }
+}
+
+void CompressedBvhTree::init(const vector<Object3D*>& geometry, const vector<const Plane*>& scene_planes)
+{
+  BvhTree::init(geometry, scene_planes);
+  vector<CompressedBvhNode<unsigned char> >().swap(nodes8);
+  vector<CompressedBvhNode<unsigned short> >().swap(nodes16);
+  vector<unsigned int>().swap(refs);
+  range_first.clear();
+  range_geometry.clear();
+  root_bbox.invalidate();
+  root_child = 0;
+  root_count = 0;
+  no_of_primitives = first_plane_primitive;
+
+  // Number the primitives object by object and then the clipped planes,
+  // which is the order of the primitives of the accelerator
+  map<const Object3D*, unsigned int> range_of;
+  unsigned int first = 0;
+  for(unsigned int i = 0; i < scene_objects.size(); ++i)
+  {
+    range_of[scene_objects[i]] = range_first.size();
+    range_first.push_back(first);
+    range_geometry.push_back(scene_objects[i]);
+    first += scene_objects[i]->get_no_of_primitives();
+  }
+  for(unsigned int i = first_plane_primitive; i < primitives.size(); ++i)
+  {
+    range_of[primitives[i]->geometry] = range_first.size();
+    range_first.push_back(first++);
+    range_geometry.push_back(primitives[i]->geometry);
+  }
+
+  if(nodes.size() > 0)
+  {
+    root_bbox = nodes[0].bbox;
+    if(nodes[0].count > 0)
+    {
+      root_child = leaf_refs(0, range_of);
+      root_count = nodes[0].count;
+    }
+    else if(wide_bounds)
+      root_child = compress(nodes16, 0, root_bbox, range_of);
+    else
+      root_child = compress(nodes8, 0, root_bbox, range_of);
+  }
+
+  build_stats = BvhTree::get_stats();
+
+  // Only the compressed tree is needed for traversal
+  vector<BvhNode>().swap(nodes);
+  vector<AccObj*>().swap(tree_objects);
+  for(unsigned int i = 0; i < primitives.size(); ++i)
+    delete primitives[i];
+  vector<AccObj*>().swap(primitives);
+}
+
+bool CompressedBvhTree::closest_hit(Ray& r, HitInfo& hit) const
+{
+  if(refs.size() > 0)
+  {
+    if(wide_bounds)
+      traverse(nodes16, r, hit, false);
+    else
+      traverse(nodes8, r, hit, false);
+  }
+  closest_plane(r, hit);
+  return hit.has_hit;
+}
+
+bool CompressedBvhTree::any_hit(Ray& r, HitInfo& hit) const
+{
+  if(refs.size() > 0 && (wide_bounds ? traverse(nodes16, r, hit, true) : traverse(nodes8, r, hit, true)))
+  {
+    hit.has_hit = true;
+    return true;
+  }
+  return any_plane(r, hit);
+}
+
+string CompressedBvhTree::describe() const
+{
+  ostringstream ostr;
+  ostr << "Compressed bounding volume hierarchy (" << (wide_bounds ? nodes16.size() : nodes8.size()) << " nodes with "
+       << (wide_bounds ? 16 : 8) << "-bit bounds, " << leaves << " leaves, " << get_bytes_per_primitive()
+       << " bytes per primitive, max depth " << max_depth << ", " << planes.size() << " planes).";
+  return ostr.str();
+}
+
+unsigned int CompressedBvhTree::get_memory_size() const
+{
+  return nodes8.size()*sizeof(CompressedBvhNode<unsigned char>) + nodes16.size()*sizeof(CompressedBvhNode<unsigned short>)
+         + refs.size()*sizeof(unsigned int) + range_first.size()*sizeof(unsigned int)
+         + range_geometry.size()*sizeof(const Object3D*);
+}
+
+float CompressedBvhTree::get_bytes_per_primitive() const
+{
+  return no_of_primitives > 0 ? get_memory_size()/static_cast<float>(no_of_primitives) : 0.0f;
+}
+
+template<class T>
+unsigned int CompressedBvhTree::compress(vector<CompressedBvhNode<T> >& compressed, unsigned int node_idx, const Aabb& bbox,
+                                         const map<const Object3D*, unsigned int>& range_of)
+{
+  // The bounds of the children are quantized relative to the dequantized
+  // bounds of the node, which are the bounds seen during traversal
+  const BvhNode& node = nodes[node_idx];
+  unsigned int idx = compressed.size();
+  compressed.push_back(CompressedBvhNode<T>());
+  compressed[idx].axis = static_cast<unsigned char>(node.axis);
+  compressed[idx].pad = 0;
+  unsigned int children[2] = { node_idx + 1, node.offset };
+  Aabb child_bbox[2];
+  for(unsigned int j = 0; j < 2; ++j)
+  {
+    quantize_bbox(nodes[children[j]].bbox, bbox, compressed[idx].bounds[j]);
+    dequantize_bbox(compressed[idx].bounds[j], bbox.m_min, bbox.m_max, child_bbox[j].m_min, child_bbox[j].m_max);
+  }
+  for(unsigned int j = 0; j < 2; ++j)
+  {
+    const BvhNode& child = nodes[children[j]];
+    unsigned int c = child.count > 0 ? leaf_refs(children[j], range_of) : compress(compressed, children[j], child_bbox[j], range_of);
+    compressed[idx].child[j] = c;
+    compressed[idx].count[j] = static_cast<unsigned char>(child.count);
+  }
+  return idx;
+}
+
+unsigned int CompressedBvhTree::leaf_refs(unsigned int node_idx, const map<const Object3D*, unsigned int>& range_of)
+{
+  const BvhNode& node = nodes[node_idx];
+  unsigned int first = refs.size();
+  for(unsigned int i = node.offset; i < node.offset + node.count; ++i)
+  {
+    const AccObj* obj = tree_objects[i];
+    refs.push_back(range_first[range_of.find(obj->geometry)->second] + obj->prim_idx);
+  }
+  return first;
+}
+
+template<class T>
+bool CompressedBvhTree::traverse(const vector<CompressedBvhNode<T> >& compressed, Ray& r, HitInfo& hit, bool any) const
+{
+  float3 inv_dir = make_float3(1.0f)/r.direction;
+  if(!intersect_bounds(root_bbox.m_min, root_bbox.m_max, r, inv_dir))
+    return false;
+
+  CompressedBvhStackEntry stack[max_stack];
+  stack[0].child = root_child;
+  stack[0].count = root_count;
+  stack[0].bbox_min = root_bbox.m_min;
+  stack[0].bbox_max = root_bbox.m_max;
+  unsigned int stack_size = 1;
+
+  // The hit info of the closest triangle is filled in after traversal
+  int closest = -1;
+  float closest_beta = 0.0f;
+  float closest_gamma = 0.0f;
+  while(stack_size > 0)
+  {
+    RT_COUNT(nodes, 1);
+
+    // Copy the entry, as its slot is reused by the children
+    const CompressedBvhStackEntry& entry = stack[--stack_size];
+    unsigned int first = entry.child;
+    unsigned int count = entry.count;
+    float3 bbox_min = entry.bbox_min;
+    float3 bbox_max = entry.bbox_max;
+    if(count > 0)
+    {
+      if(any)
+      {
+        if(intersect_refs_any(r, first, count))
+          return true;
+      }
+      else
+        intersect_refs(r, hit, first, count, closest, closest_beta, closest_gamma);
+      continue;
+    }
+
+    // Push the far child first to visit the child on the near side of the split first
+    const CompressedBvhNode<T>& node = compressed[first];
+    unsigned int near_child = *(&r.direction.x + node.axis) < 0.0f ? 1 : 0;
+    for(unsigned int k = 0; k < 2; ++k)
+    {
+      unsigned int j = k == 0 ? 1 - near_child : near_child;
+      CompressedBvhStackEntry& child = stack[stack_size];
+      dequantize_bbox(node.bounds[j], bbox_min, bbox_max, child.bbox_min, child.bbox_max);
+      if(intersect_bounds(child.bbox_min, child.bbox_max, r, inv_dir))
+      {
+        child.child = node.child[j];
+        child.count = node.count[j];
+        ++stack_size;
+      }
+    }
+  }
+  if(closest >= 0)
+  {
+    unsigned int prim_idx;
+    const Object3D* geometry = ref_geometry(closest, prim_idx);
+    geometry->fill_hit_info(r, hit, prim_idx, r.tmax, closest_beta, closest_gamma);
+  }
+  return false;
+}
+
+const Object3D* CompressedBvhTree::ref_geometry(unsigned int i, unsigned int& prim_idx) const
+{
+  unsigned int idx = refs[i];
+  unsigned int k = upper_bound(range_first.begin(), range_first.end(), idx) - range_first.begin() - 1;
+  prim_idx = idx - range_first[k];
+  return range_geometry[k];
+}
+
+void CompressedBvhTree::intersect_refs(Ray& r, HitInfo& hit, unsigned int first, unsigned int count,
+                                       int& closest, float& closest_beta, float& closest_gamma) const
+{
+  RT_COUNT(primitives, count);
+  for(unsigned int i = first; i < first + count; ++i)
+  {
+    unsigned int prim_idx;
+    const Object3D* geometry = ref_geometry(i, prim_idx);
+    float3 v0, v1, v2, n;
+    float t, beta, gamma;
+    if(geometry->get_triangle(prim_idx, v0, v1, v2))
+    {
+      if(::intersect_triangle(r, v0, v1, v2, n, t, beta, gamma))
+      {
+        r.tmax = t;
+        closest = i;
+        closest_beta = beta;
+        closest_gamma = gamma;
+      }
+    }
+    else if(geometry->intersect(r, hit, prim_idx))
+    {
+      r.tmax = hit.dist;
+      closest = -1;
+    }
+  }
+}
+
+bool CompressedBvhTree::intersect_refs_any(const Ray& r, unsigned int first, unsigned int count) const
+{
+  RT_COUNT(primitives, count);
+  for(unsigned int i = first; i < first + count; ++i)
+  {
+    unsigned int prim_idx;
+    const Object3D* geometry = ref_geometry(i, prim_idx);
+    if(geometry->intersect_any(r, prim_idx))
+      return true;
+  }
+  return false;
+}
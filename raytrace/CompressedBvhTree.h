@@ -0,0 +1,93 @@
+// 02562 Rendering Framework
+// Bounding volume hierarchy with child bounds quantized relative to the
+// bounds of their parent [Mahovsky, PhD thesis, University of Calgary 2005].
+// Copyright (c) DTU Informatics 2011
+
+#ifndef COMPRESSEDBVHTREE_H
+#define COMPRESSEDBVHTREE_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <optix_world.h>
+#include "AccObj.h"
+#include "Object3D.h"
+#include "Plane.h"
+#include "HitInfo.h"
+#include "BvhTree.h"
+
+// The bounds of both children of a binary node, each coordinate stored as
+// an unsigned integer of type T that selects one of the evenly spaced
+// planes spanning the bounds of the node
+template<class T>
+struct CompressedBvhNode
+{
+  T bounds[2][2][3];       // [child][min/max][axis]
+  unsigned int child[2];   // index of a child node or of the first reference of a leaf child
+  unsigned char count[2];  // number of references in a leaf child, 0 for child nodes
+  unsigned char axis;      // split axis (the first child is on the lower side)
+  unsigned char pad;
+};
+
+// Builds a binary BVH and stores it compressed: child bounds quantized to
+// 8 or 16 bits and leaves referencing primitives by 32-bit indices. The
+// primitive objects are released after the build, which leaves only the
+// compressed tree in memory, so refitting rebuilds the tree.
+class CompressedBvhTree : public BvhTree
+{
+public:
+  CompressedBvhTree(unsigned int bits = 8, unsigned int max_objects_in_leaf = 4, unsigned int no_of_bins = 16)
+    : BvhTree(std::min(max_objects_in_leaf, 255u), no_of_bins), wide_bounds(bits > 8),
+      root_child(0), root_count(0), no_of_primitives(0)
+  {
+    // Leaves are intersected reference by reference, so they are neither
+    // padded nor copied to a triangle buffer. They are still priced by
+    // whole triangle blocks, which keeps the tree and thereby its memory
+    // use small.
+    block_leaves = false;
+  }
+
+  virtual void init(const std::vector<Object3D*>& geometry, const std::vector<const Plane*>& planes);
+  virtual bool closest_hit(optix::Ray& r, HitInfo& hit) const;
+  virtual bool any_hit(optix::Ray& r, HitInfo& hit) const;
+  virtual std::string describe() const;
+  virtual AccStats get_stats() const { return build_stats; }
+  virtual void refit() { rebuild(); }
+
+  // Memory used by the tree and the primitive references
+  unsigned int get_memory_size() const;
+  float get_bytes_per_primitive() const;
+
+private:
+  template<class T>
+  unsigned int compress(std::vector<CompressedBvhNode<T> >& compressed, unsigned int node_idx, const optix::Aabb& bbox,
+                        const std::map<const Object3D*, unsigned int>& range_of);
+  template<class T>
+  bool traverse(const std::vector<CompressedBvhNode<T> >& compressed, optix::Ray& r, HitInfo& hit, bool any) const;
+  unsigned int leaf_refs(unsigned int node_idx, const std::map<const Object3D*, unsigned int>& range_of);
+  const Object3D* ref_geometry(unsigned int i, unsigned int& prim_idx) const;
+  void intersect_refs(optix::Ray& r, HitInfo& hit, unsigned int first, unsigned int count,
+                      int& closest, float& closest_beta, float& closest_gamma) const;
+  bool intersect_refs_any(const optix::Ray& r, unsigned int first, unsigned int count) const;
+
+  bool wide_bounds;
+  std::vector<CompressedBvhNode<unsigned char> > nodes8;
+  std::vector<CompressedBvhNode<unsigned short> > nodes16;
+
+  // The root is not stored in a node. A leaf references primitive i of
+  // range k, where the ranges are the objects and the clipped planes in
+  // the order their primitives had in the accelerator.
+  optix::Aabb root_bbox;
+  unsigned int root_child;
+  unsigned int root_count;
+  std::vector<unsigned int> refs;
+  std::vector<unsigned int> range_first;
+  std::vector<const Object3D*> range_geometry;
+  unsigned int no_of_primitives;
+
+  // Statistics of the binary tree, which has the same structure
+  AccStats build_stats;
+};
+
+#endif // COMPRESSEDBVHTREE_H
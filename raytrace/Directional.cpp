@@ -38,7 +38,7 @@ bool Directional::sample(const float3& pos, float3& dir, float3& L) const
     float epsilon = 10e-4;
     Ray r(pos, dir, 0, epsilon, RT_DEFAULT_MAX);
     HitInfo hit;
-    return !tracer->trace_to_closest(r, hit);
+    return !tracer->trace_to_any(r, hit);
   }
 
   return true;
@@ -15,6 +15,8 @@ using namespace optix;
 
 void GLViewController::reset_projection()
 {
+  if(headless())
+    return;
   glMatrixMode(GL_PROJECTION);
   glLoadIdentity();
   gluPerspective(FOV_DEG, aspect, znear, zfar);
@@ -99,7 +101,8 @@ void GLViewController::reshape(unsigned int W, unsigned int H)
   WINX = W;
   WINY = H;
   aspect = WINX/static_cast<float>(WINY);
-  glViewport(0,0,WINX,WINY);
+  if(!headless())
+    glViewport(0,0,WINX,WINY);
   reset_projection();
   ball.set_screen_window(WINX, WINY);
 }  
@@ -24,6 +24,8 @@ void HDRTexture::load_hdr(const char* file_name)
   fdata = new float4[img_size];
   for(int i = 0; i < img_size; ++i)
     fdata[i] = look_up(i);
+  if(headless())
+    return;
   tex_handle = SOIL_load_OGL_texture(file_name, SOIL_LOAD_AUTO, tex_handle, SOIL_FLAG_INVERT_Y);
   if(!glIsTexture(tex_handle))
     cerr << "Error: Could not construct OpenGL texture from loaded image." << endl;
@@ -25,7 +25,7 @@ float3 Holdout::shade(const Ray& r, HitInfo& hit, bool emit) const
   // samples      (number of times to trace a sample ray)
   // tracer       (pointer to ray tracer)
   //
-  // Hint: Use the function tracer->trace_to_closest(...) to trace
+  // Hint: Use the function tracer->trace_to_any(...) to trace
   //       a new ray in a direction sampled on the hemisphere around the
   //       surface normal according to the function sample_cosine_weighted(...).
 
@@ -33,7 +33,7 @@ float3 Holdout::shade(const Ray& r, HitInfo& hit, bool emit) const
     Ray new_ray = Ray(hit.position, sample_cosine_weighted(hit.shading_normal), 0, 1e-4, RT_DEFAULT_MAX);
     HitInfo new_hit;
 
-    if(!tracer->trace_to_closest(new_ray, new_hit))
+    if(!tracer->trace_to_any(new_ray, new_hit))
       ambient++;
   }
   ambient /= samples;
@@ -0,0 +1,68 @@
+// 02562 Rendering Framework
+// Placement of a shared triangle mesh with a transformation.
+// Copyright (c) DTU Informatics 2011
+
+#include <optix_world.h>
+#include "HitInfo.h"
+#include "Instance.h"
+
+using namespace optix;
+
+bool Instance::intersect(const Ray& r, HitInfo& hit, unsigned int prim_idx) const
+{
+  float scale;
+  Ray object_ray = to_object_space(r, scale);
+
+  // Keep the fields set by the caller, such as the trace depth
+  HitInfo object_hit = hit;
+  object_hit.has_hit = false;
+  if(!acc->closest_hit(object_ray, object_hit))
+    return false;
+
+  hit = object_hit;
+  hit.dist = object_hit.dist/scale;
+  hit.position = r.origin + r.direction*hit.dist;
+  hit.geometric_normal = normalize(make_float3(normal_to_world*make_float4(object_hit.geometric_normal, 0.0f)));
+  hit.shading_normal = normalize(make_float3(normal_to_world*make_float4(object_hit.shading_normal, 0.0f)));
+  return true;
+}
+
+bool Instance::intersect_any(const Ray& r, unsigned int prim_idx) const
+{
+  float scale;
+  Ray object_ray = to_object_space(r, scale);
+  HitInfo object_hit;
+  return acc->any_hit(object_ray, object_hit);
+}
+
+Aabb Instance::compute_bbox() const
+{
+  Aabb object_bbox = mesh->compute_bbox();
+  Aabb bbox;
+  for(unsigned int i = 0; i < 8; ++i)
+  {
+    float3 corner = make_float3(i & 1 ? object_bbox.m_max.x : object_bbox.m_min.x,
+                                i & 2 ? object_bbox.m_max.y : object_bbox.m_min.y,
+                                i & 4 ? object_bbox.m_max.z : object_bbox.m_min.z);
+    bbox.include(make_float3(object_to_world*make_float4(corner, 1.0f)));
+  }
+  return bbox;
+}
+
+void Instance::set_transform(const Matrix4x4& m)
+{
+  object_to_world = m;
+  world_to_object = m.inverse();
+  normal_to_world = world_to_object.transpose();
+}
+
+Ray Instance::to_object_space(const Ray& r, float& scale) const
+{
+  // The intersection thresholds of the triangles assume a unit direction,
+  // so the direction is normalized in object space and distances along
+  // the ray are scaled accordingly
+  float3 origin = make_float3(world_to_object*make_float4(r.origin, 1.0f));
+  float3 direction = make_float3(world_to_object*make_float4(r.direction, 0.0f));
+  scale = length(direction);
+  return Ray(origin, direction/scale, r.ray_type, r.tmin*scale, r.tmax*scale);
+}
@@ -0,0 +1,57 @@
+// 02562 Rendering Framework
+// Placement of a shared triangle mesh with a transformation.
+// Copyright (c) DTU Informatics 2011
+
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <optix_world.h>
+#include "HitInfo.h"
+#include "Object3D.h"
+#include "TriMesh.h"
+#include "Accelerator.h"
+
+// A mesh loaded once for all its instances together with the bottom-level
+// acceleration structure built over its triangles in object space
+struct InstancedMesh
+{
+  InstancedMesh() : mesh(0), acc(0) { }
+
+  TriMesh* mesh;
+  Accelerator* acc;
+};
+
+// An instance is a single primitive to the top-level acceleration
+// structure. Rays are transformed into the object space of the mesh and
+// traced through the shared bottom-level structure, so the memory used by
+// an instance does not depend on the size of the mesh.
+class Instance : public Object3D
+{
+public:
+  Instance(const InstancedMesh& instanced_mesh, const optix::Matrix4x4& transform)
+    : mesh(instanced_mesh.mesh), acc(instanced_mesh.acc)
+  {
+    set_transform(transform);
+  }
+
+  virtual bool intersect(const optix::Ray& r, HitInfo& hit, unsigned int prim_idx) const;
+  virtual bool intersect_any(const optix::Ray& r, unsigned int prim_idx) const;
+  virtual void transform(const optix::Matrix4x4& m) { set_transform(m*object_to_world); }
+  virtual optix::Aabb compute_bbox() const;
+
+  const TriMesh* get_mesh() const { return mesh; }
+  const optix::Matrix4x4& get_transform() const { return object_to_world; }
+  const optix::Matrix4x4& get_normal_transform() const { return normal_to_world; }
+
+private:
+  void set_transform(const optix::Matrix4x4& m);
+  optix::Ray to_object_space(const optix::Ray& r, float& scale) const;
+
+  const TriMesh* mesh;
+  const Accelerator* acc;
+  optix::Matrix4x4 object_to_world;
+  optix::Matrix4x4 world_to_object;
+  optix::Matrix4x4 normal_to_world;
+};
+
+#endif // INSTANCE_H
@@ -4,6 +4,7 @@
 
 #include <optix_world.h>
 #include "mt_random.h"
+#include "PixelSampler.h"
 #include "sampler.h"
 #include "HitInfo.h"
 #include "MCGlossy.h"
@@ -39,7 +40,7 @@ float3 MCGlossy::shade(const Ray& r, HitInfo& hit, bool emit) const
   //       the shader for the surface it hit.
 
   float prob = (rho_d.x + rho_d.y + rho_d.z)/3.0;
-  if(safe_mt_random() < prob) {
+  if(next_sample() < prob) {
     Ray *new_ray = new Ray(hit.position, sample_cosine_weighted(hit.shading_normal), 0, 1e-4, RT_DEFAULT_MAX);
     HitInfo new_hit;
 
@@ -27,7 +27,8 @@ void MerlTexture::load(const char* filename)
   delete [] fdata;
   fdata = new float4[1];
   fdata[0] = make_float4(rho_d);
-  tex_handle = SOIL_create_OGL_texture(data, width, height, channels, tex_handle, SOIL_FLAG_INVERT_Y | SOIL_FLAG_TEXTURE_REPEATS);
+  if(!headless())
+    tex_handle = SOIL_create_OGL_texture(data, width, height, channels, tex_handle, SOIL_FLAG_INVERT_Y | SOIL_FLAG_TEXTURE_REPEATS);
   tex_target = GL_TEXTURE_2D;
 }
 
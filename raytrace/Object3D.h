@@ -12,6 +12,14 @@ class Object3D
 {
 public:
   virtual bool intersect(const optix::Ray& r, HitInfo& hit, unsigned int prim_idx) const = 0;
+
+  // Occlusion test for shadow rays. Only reports whether the primitive is hit
+  // within [r.tmin, r.tmax] and leaves shading attributes uncomputed.
+  virtual bool intersect_any(const optix::Ray& r, unsigned int prim_idx) const
+  {
+    HitInfo hit;
+    return intersect(r, hit, prim_idx);
+  }
   virtual void transform(const optix::Matrix4x4& m) = 0;
   virtual optix::Aabb compute_bbox() const = 0;
   virtual void compute_bsphere(optix::float3& center, float& radius) const
@@ -21,6 +29,11 @@ public:
     radius = length(bbox.extent())*0.5f;
   }
   virtual optix::Aabb get_primitive_bbox(unsigned int prim_idx) const { return compute_bbox(); }
+
+  // Triangle primitives can hand their vertices to an accelerator, which then
+  // intersects them directly and asks for the hit info of the closest hit only.
+  virtual bool get_triangle(unsigned int prim_idx, optix::float3& v0, optix::float3& v1, optix::float3& v2) const { return false; }
+  virtual void fill_hit_info(const optix::Ray& r, HitInfo& hit, unsigned int prim_idx, float t, float beta, float gamma) const { }
   virtual unsigned int get_no_of_primitives() const { return 1; }
 };
 
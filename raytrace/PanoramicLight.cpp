@@ -6,6 +6,7 @@
 #include "string_utils.h"
 #include "RayTracer.h"
 #include "mt_random.h"
+#include "PixelSampler.h"
 #include "sampler.h"
 #include "luminance.h"
 #include "Light.h"
@@ -59,7 +60,7 @@ PanoramicLight::PanoramicLight(RayTracer* ray_tracer, const PanoramicTexture& pa
 
 bool PanoramicLight::sample(const float3& pos, float3& dir, float3& L) const
 {
-  float xi1 = mt_random(), xi2 = mt_random(), prob;
+  float xi1 = next_sample(), xi2 = next_sample(), prob;
   float2 uv = distribution->sample_continuous(xi1, xi2, prob);
   float theta = uv.y*M_PIf;
   float phi = uv.x*M_2PIf;
@@ -69,7 +70,7 @@ bool PanoramicLight::sample(const float3& pos, float3& dir, float3& L) const
   {
     Ray s(pos, dir, 0, 1.0e-4f);
     HitInfo hit;
-    if(tracer->trace_to_closest(s, hit))
+    if(tracer->trace_to_any(s, hit))
       return false;
   }
   L = make_float3(envtex.sample_linear(dir))*sin_theta*M_2PIPIf/prob;
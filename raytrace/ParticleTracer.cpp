@@ -50,7 +50,7 @@ void ParticleTracer::build_maps(int no_of_caustic_particles, unsigned int max_no
     }
     
     // Trace a block of photons at the time
-    //#pragma omp parallel for private(randomizer)
+    //#pragma omp parallel for
     for(int i = 0; i < block; ++i)
     {
       // Sample a light source
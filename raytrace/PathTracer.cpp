@@ -1,24 +1,38 @@
 #include <optix_world.h>
 #include "mt_random.h"
+#include "PixelSampler.h"
 #include "PathTracer.h"
 
 using namespace optix;
 
 void PathTracer::update_pixel(unsigned int x, unsigned int y, float sample_number, float3& L) const
 {
-  float2 ip_coords = make_float2(x + mt_random(), y + mt_random())*win_to_ip + lower_left;
+  float3 sample = compute_sample(x, y, static_cast<unsigned int>(sample_number));
+  L *= sample_number;
+  L += sample;
+  L /= sample_number + 1.0f;
+}
+
+float3 PathTracer::compute_sample(unsigned int x, unsigned int y, unsigned int sample) const
+{
+  // The first two dimensions of the pixel sample place it in the pixel
+  // and the shaders and lights draw the rest
+  begin_pixel_sample(x, y, sample);
+  float2 jitter = make_float2(next_sample(), next_sample());
+  float2 ip_coords = (make_float2(x, y) + jitter)*win_to_ip + lower_left;
   Ray r = scene->get_camera()->get_ray(ip_coords);
   HitInfo hit;
 
-  L *= sample_number;
+  float3 L = make_float3(0.0f);
   if(trace_to_closest(r, hit))
   {
     const Shader* shader = get_shader(hit);
     if(shader)
-      L += shader->shade(r, hit);
+      L = shader->shade(r, hit);
   }
   else
-    L += get_background(r.direction);
-  L /= sample_number + 1.0f;
+    L = get_background(r.direction);
+  end_pixel_sample();
+  return L;
 }
 
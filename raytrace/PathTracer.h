@@ -13,6 +13,9 @@ public:
   { }  
 
 	virtual void update_pixel(unsigned int x, unsigned int y, float sample_number, optix::float3& L) const;
+
+  // Radiance of sample number 'sample' through pixel (x, y)
+  virtual optix::float3 compute_sample(unsigned int x, unsigned int y, unsigned int sample) const;
 };
 
 #endif // PATHTRACER_H
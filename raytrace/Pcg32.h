@@ -0,0 +1,66 @@
+// 02562 Rendering Framework
+// PCG32 random number generator [O'Neill, PCG: A family of simple fast
+// space-efficient statistically good algorithms for random number
+// generation, Harvey Mudd College HMC-CS-2014-0905, 2014].
+// Copyright (c) DTU Informatics 2011
+
+#ifndef PCG32_H
+#define PCG32_H
+
+// 64-bit linear congruential state with a permuted 32-bit output. Every
+// odd increment selects a different stream, and the generator can jump
+// to any position in its stream in logarithmic time.
+class Pcg32
+{
+public:
+  Pcg32() : state(0x853c49e6748fea9bULL), inc(0xda3e39cb94b95bdbULL) { }
+
+  // Starts stream number seq at the position given by init_state
+  void seed(unsigned long long init_state, unsigned long long seq)
+  {
+    state = 0;
+    inc = (seq << 1) | 1;
+    next_uint();
+    state += init_state;
+    next_uint();
+  }
+
+  unsigned int next_uint()
+  {
+    unsigned long long old_state = state;
+    state = old_state*multiplier + inc;
+    unsigned int xorshifted = static_cast<unsigned int>(((old_state >> 18) ^ old_state) >> 27);
+    unsigned int rot = static_cast<unsigned int>(old_state >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+  }
+
+  // Skips delta numbers [Brown, Random number generation with arbitrary
+  // strides, Transactions of the American Nuclear Society 71, 1994]
+  void advance(unsigned long long delta)
+  {
+    unsigned long long cur_mult = multiplier;
+    unsigned long long cur_plus = inc;
+    unsigned long long acc_mult = 1;
+    unsigned long long acc_plus = 0;
+    while(delta > 0)
+    {
+      if(delta & 1)
+      {
+        acc_mult *= cur_mult;
+        acc_plus = acc_plus*cur_mult + cur_plus;
+      }
+      cur_plus = (cur_mult + 1)*cur_plus;
+      cur_mult *= cur_mult;
+      delta >>= 1;
+    }
+    state = acc_mult*state + acc_plus;
+  }
+
+private:
+  static const unsigned long long multiplier = 0x5851f42d4c957f2dULL;
+
+  unsigned long long state;
+  unsigned long long inc;
+};
+
+#endif // PCG32_H
@@ -0,0 +1,314 @@
+// 02562 Rendering Framework
+// Low-discrepancy samples for the dimensions of a pixel sample.
+// Copyright (c) DTU Informatics 2011
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include "Randomizer.h"
+#include "mt_random.h"
+#include "PixelSampler.h"
+
+using namespace std;
+
+namespace
+{
+  // Sampler used by next_sample(), see set_pixel_sampler(...)
+  const PixelSampler* pixel_sampler = 0;
+
+  // Pixel sample traced by the calling thread
+  bool sample_active = false;
+  unsigned int sample_x = 0;
+  unsigned int sample_y = 0;
+  unsigned int sample_index = 0;
+  unsigned int sample_dimension = 0;
+  #pragma omp threadprivate(sample_active, sample_x, sample_y, sample_index, sample_dimension)
+
+  // Primitive polynomials and initial direction numbers of the second to
+  // fourth Sobol dimensions [Joe and Kuo, SIAM Journal on Scientific
+  // Computing 30(5), 2008]. The first dimension is the van der Corput
+  // sequence.
+  const unsigned int sobol_degree[3] = { 1, 2, 3 };
+  const unsigned int sobol_a[3] = { 0, 1, 1 };
+  const unsigned int sobol_m[3][3] = { { 1, 0, 0 }, { 1, 3, 0 }, { 1, 3, 1 } };
+
+  const unsigned int no_of_primes = 32;
+  const unsigned int primes[no_of_primes] =
+  {
+      2,   3,   5,   7,  11,  13,  17,  19,  23,  29,  31,  37,  41,  43,  47,  53,
+     59,  61,  67,  71,  73,  79,  83,  89,  97, 101, 103, 107, 109, 113, 127, 131
+  };
+
+  // Finalizer of the 32-bit MurmurHash3
+  unsigned int mix_bits(unsigned int h)
+  {
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+  }
+
+  unsigned int hash_combine(unsigned int seed, unsigned int v)
+  {
+    return mix_bits(seed ^ (v + 0x9e3779b9U + (seed << 6) + (seed >> 2)));
+  }
+
+  unsigned int reverse_bits(unsigned int x)
+  {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffU) << 8) | ((x & 0xff00ff00U) >> 8);
+    x = ((x & 0x0f0f0f0fU) << 4) | ((x & 0xf0f0f0f0U) >> 4);
+    x = ((x & 0x33333333U) << 2) | ((x & 0xccccccccU) >> 2);
+    x = ((x & 0x55555555U) << 1) | ((x & 0xaaaaaaaaU) >> 1);
+    return x;
+  }
+
+  // Hash in which every bit only depends on the bits below it, which
+  // becomes an Owen scramble when applied to the reversed bits
+  // [Laine and Karras, Stratified sampling for stochastic transparency,
+  //  EGSR 2011; Burley, JCGT 9(4), 2020]
+  unsigned int nested_uniform_scramble(unsigned int x, unsigned int seed)
+  {
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x*0x6c50b47cU;
+    x ^= x*0xb82f1e52U;
+    x ^= x*0xc7afe638U;
+    x ^= x*0x8d22f6e6U;
+    return reverse_bits(x);
+  }
+
+  // The upper 24 bits fit in a float, so the result stays below one
+  float to_unit_float(unsigned int x)
+  {
+    return (x >> 8)*(1.0f/16777216.0f);
+  }
+
+  float radical_inverse(unsigned int base, unsigned int index)
+  {
+    double inv_base = 1.0/base;
+    double inv_digit = inv_base;
+    double result = 0.0;
+    while(index > 0)
+    {
+      result += (index % base)*inv_digit;
+      index /= base;
+      inv_digit *= inv_base;
+    }
+    return static_cast<float>(result);
+  }
+
+  float wrap(float x)
+  {
+    x -= floor(x);
+    return x < 1.0f ? x : 0.0f;
+  }
+
+  // Adds (sign = 1) or removes (sign = -1) the energy of a point at
+  // pixel p of a toroidal size x size pattern
+  void add_energy(vector<float>& energy, const vector<float>& kernel, unsigned int size, unsigned int p, float sign)
+  {
+    unsigned int px = p%size;
+    unsigned int py = p/size;
+    for(unsigned int y = 0; y < size; ++y)
+    {
+      const float* k = &kernel[((y + size - py)%size)*size];
+      float* e = &energy[y*size];
+      for(unsigned int x = 0; x < size; ++x)
+        e[x] += sign*k[(x + size - px)%size];
+    }
+  }
+
+  unsigned int tightest_cluster(const vector<float>& energy, const vector<char>& pattern)
+  {
+    unsigned int best = 0;
+    float most = -1.0f;
+    for(unsigned int i = 0; i < energy.size(); ++i)
+      if(pattern[i] && energy[i] > most)
+      {
+        most = energy[i];
+        best = i;
+      }
+    return best;
+  }
+
+  unsigned int largest_void(const vector<float>& energy, const vector<char>& pattern)
+  {
+    unsigned int best = 0;
+    float least = 1.0e30f;
+    for(unsigned int i = 0; i < energy.size(); ++i)
+      if(!pattern[i] && energy[i] < least)
+      {
+        least = energy[i];
+        best = i;
+      }
+    return best;
+  }
+}
+
+SobolSampler::SobolSampler(unsigned int seed_value)
+  : PixelSampler(seed_value)
+{
+  for(unsigned int i = 0; i < 32; ++i)
+    directions[0][i] = 1U << (31 - i);
+  for(unsigned int d = 1; d < 4; ++d)
+  {
+    unsigned int s = sobol_degree[d - 1];
+    unsigned int a = sobol_a[d - 1];
+    unsigned int* v = directions[d];
+    for(unsigned int i = 0; i < s; ++i)
+      v[i] = sobol_m[d - 1][i] << (31 - i);
+    for(unsigned int i = s; i < 32; ++i)
+    {
+      v[i] = v[i - s] ^ (v[i - s] >> s);
+      for(unsigned int k = 1; k < s; ++k)
+        v[i] ^= ((a >> (s - 1 - k)) & 1)*v[i - k];
+    }
+  }
+}
+
+float SobolSampler::sobol_owen(unsigned int index, unsigned int dimension, unsigned int scramble) const
+{
+  // Every group of four dimensions draws the points in a different order.
+  // An Owen-scrambled index keeps the first 2^k points of the order a
+  // Sobol point set of its own.
+  unsigned int group_seed = hash_combine(scramble, dimension/4);
+  unsigned int i = nested_uniform_scramble(index, group_seed);
+  const unsigned int* v = directions[dimension%4];
+  unsigned int x = 0;
+  for(unsigned int bit = 0; i > 0; ++bit, i >>= 1)
+    if(i & 1)
+      x ^= v[bit];
+  return to_unit_float(nested_uniform_scramble(x, hash_combine(group_seed, dimension%4)));
+}
+
+float SobolSampler::sample(unsigned int x, unsigned int y, unsigned int index, unsigned int dimension) const
+{
+  return sobol_owen(index, dimension, hash_combine(hash_combine(seed, x), y));
+}
+
+float HaltonSampler::sample(unsigned int x, unsigned int y, unsigned int index, unsigned int dimension) const
+{
+  unsigned int h = hash_combine(hash_combine(hash_combine(seed, x), y), dimension);
+  return wrap(radical_inverse(primes[dimension%no_of_primes], index) + to_unit_float(h));
+}
+
+BlueNoiseSampler::BlueNoiseSampler(unsigned int seed_value, unsigned int mask_size)
+  : PixelSampler(seed_value), sobol(seed_value), size(mask_size)
+{
+  make_mask();
+}
+
+float BlueNoiseSampler::sample(unsigned int x, unsigned int y, unsigned int index, unsigned int dimension) const
+{
+  unsigned int h = hash_combine(seed, dimension);
+  unsigned int mx = (x + (h & 0xffff))%size;
+  unsigned int my = (y + (h >> 16))%size;
+  return wrap(sobol.sobol_owen(index, dimension, seed) + mask[my*size + mx]);
+}
+
+void BlueNoiseSampler::make_mask()
+{
+  // Void-and-cluster: the energy of a pixel is the sum of a Gaussian of
+  // its toroidal distance to the points of the pattern. The tightest
+  // cluster is the point of highest energy and the largest void the
+  // empty pixel of lowest energy.
+  const float sigma = 1.5f;
+  unsigned int n = size*size;
+  vector<float> kernel(n);
+  for(unsigned int y = 0; y < size; ++y)
+    for(unsigned int x = 0; x < size; ++x)
+    {
+      float dx = static_cast<float>(std::min(x, size - x));
+      float dy = static_cast<float>(std::min(y, size - y));
+      kernel[y*size + x] = exp(-(dx*dx + dy*dy)/(2.0f*sigma*sigma));
+    }
+
+  vector<float> energy(n, 0.0f);
+  vector<char> pattern(n, 0);
+
+  // Initial pattern of random points which are moved from clusters to
+  // voids until that no longer changes the pattern
+  Randomizer rng(seed + 5489UL);
+  unsigned int ones = std::max(1U, n/10);
+  for(unsigned int placed = 0; placed < ones; )
+  {
+    unsigned int p = static_cast<unsigned int>(rng.mt_random_int32()%n);
+    if(pattern[p])
+      continue;
+    pattern[p] = 1;
+    add_energy(energy, kernel, size, p, 1.0f);
+    ++placed;
+  }
+  for(unsigned int iter = 0; iter < n; ++iter)
+  {
+    unsigned int cluster = tightest_cluster(energy, pattern);
+    pattern[cluster] = 0;
+    add_energy(energy, kernel, size, cluster, -1.0f);
+    unsigned int hole = largest_void(energy, pattern);
+    pattern[hole] = 1;
+    add_energy(energy, kernel, size, hole, 1.0f);
+    if(hole == cluster)
+      break;
+  }
+
+  // Rank the initial points by removing the tightest clusters first, and
+  // the rest by filling the largest voids
+  vector<unsigned int> rank(n, 0);
+  vector<char> initial = pattern;
+  vector<float> initial_energy = energy;
+  for(unsigned int r = ones; r > 0; --r)
+  {
+    unsigned int cluster = tightest_cluster(energy, pattern);
+    pattern[cluster] = 0;
+    add_energy(energy, kernel, size, cluster, -1.0f);
+    rank[cluster] = r - 1;
+  }
+  pattern = initial;
+  energy = initial_energy;
+  for(unsigned int r = ones; r < n; ++r)
+  {
+    unsigned int hole = largest_void(energy, pattern);
+    pattern[hole] = 1;
+    add_energy(energy, kernel, size, hole, 1.0f);
+    rank[hole] = r;
+  }
+
+  mask.resize(n);
+  for(unsigned int i = 0; i < n; ++i)
+    mask[i] = (rank[i] + 0.5f)/n;
+}
+
+void set_pixel_sampler(const PixelSampler* sampler)
+{
+  pixel_sampler = sampler;
+}
+
+const PixelSampler* get_pixel_sampler()
+{
+  return pixel_sampler;
+}
+
+void begin_pixel_sample(unsigned int x, unsigned int y, unsigned int index, unsigned int dimension)
+{
+  sample_active = true;
+  sample_x = x;
+  sample_y = y;
+  sample_index = index;
+  sample_dimension = dimension;
+}
+
+void end_pixel_sample()
+{
+  sample_active = false;
+}
+
+float next_sample()
+{
+  if(pixel_sampler && sample_active)
+    return pixel_sampler->sample(sample_x, sample_y, sample_index, sample_dimension++);
+  return static_cast<float>(mt_random_half_open());
+}
@@ -0,0 +1,92 @@
+// 02562 Rendering Framework
+// Low-discrepancy samples for the dimensions of a pixel sample: Sobol
+// points with hash-based Owen scrambling [Burley, Journal of Computer
+// Graphics Techniques 9(4), 2020], randomized Halton points and Sobol
+// points shifted by a blue-noise mask [Georgiev and Fajardo, SIGGRAPH
+// Talks 2016].
+// Copyright (c) DTU Informatics 2011
+
+#ifndef PIXELSAMPLER_H
+#define PIXELSAMPLER_H
+
+#include <vector>
+#include <string>
+
+// Returns component 'dimension' in [0,1) of sample 'index' of pixel
+// (x, y). The first two dimensions of a sample place it in the pixel and
+// the rest are used in the order the shaders and lights ask for them.
+class PixelSampler
+{
+public:
+  PixelSampler(unsigned int seed_value = 0) : seed(seed_value) { }
+  virtual ~PixelSampler() { }
+
+  virtual float sample(unsigned int x, unsigned int y, unsigned int index, unsigned int dimension) const = 0;
+  virtual std::string describe() const = 0;
+
+protected:
+  unsigned int seed;
+};
+
+// Owen-scrambled Sobol points. The points of a pixel are scrambled with
+// a seed of their own, and dimensions beyond the first four reuse the
+// four-dimensional points in a shuffled order.
+class SobolSampler : public PixelSampler
+{
+public:
+  SobolSampler(unsigned int seed_value = 0);
+
+  virtual float sample(unsigned int x, unsigned int y, unsigned int index, unsigned int dimension) const;
+  virtual std::string describe() const { return "Owen-scrambled Sobol sampler"; }
+
+  // Dimension of the Sobol points with the given scramble seed
+  float sobol_owen(unsigned int index, unsigned int dimension, unsigned int scramble) const;
+
+private:
+  unsigned int directions[4][32];
+};
+
+// Halton points with a random toroidal shift per pixel and dimension
+// [Cranley and Patterson, SIAM Journal on Numerical Analysis 13(6), 1976].
+// Dimensions beyond the number of tabulated primes reuse the primes with
+// new shifts.
+class HaltonSampler : public PixelSampler
+{
+public:
+  HaltonSampler(unsigned int seed_value = 0) : PixelSampler(seed_value) { }
+
+  virtual float sample(unsigned int x, unsigned int y, unsigned int index, unsigned int dimension) const;
+  virtual std::string describe() const { return "Halton sampler"; }
+};
+
+// Every pixel uses the same Sobol points, toroidally shifted by the value
+// of a blue-noise mask at the pixel. The mask is moved by a random offset
+// for every dimension. The error of neighbouring pixels is then
+// uncorrelated at low sample counts and looks like blue noise. The mask
+// is made by the void-and-cluster method [Ulichney, SPIE 1913, 1993].
+class BlueNoiseSampler : public PixelSampler
+{
+public:
+  BlueNoiseSampler(unsigned int seed_value = 0, unsigned int mask_size = 64);
+
+  virtual float sample(unsigned int x, unsigned int y, unsigned int index, unsigned int dimension) const;
+  virtual std::string describe() const { return "Blue-noise shifted Sobol sampler"; }
+
+private:
+  void make_mask();
+
+  SobolSampler sobol;
+  unsigned int size;
+  std::vector<float> mask;
+};
+
+// The shaders and lights draw the numbers of the pixel sample traced by
+// the calling thread with next_sample(). Outside a pixel sample, or if no
+// sampler is selected, they get independent random numbers.
+void set_pixel_sampler(const PixelSampler* sampler);
+const PixelSampler* get_pixel_sampler();
+void begin_pixel_sample(unsigned int x, unsigned int y, unsigned int index, unsigned int dimension = 0);
+void end_pixel_sample();
+float next_sample();
+
+#endif // PIXELSAMPLER_H
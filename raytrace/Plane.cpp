@@ -63,6 +63,17 @@ bool Plane::intersect(const Ray& r, HitInfo& hit, unsigned int prim_idx) const
   return false;
 }
 
+bool Plane::intersect_any(const Ray& r, unsigned int prim_idx) const
+{
+  float denominator = dot(r.direction, get_normal());
+  if(fabs(denominator) > 0.0001f)
+  {
+    float t = -(dot(r.origin, get_normal()) + d)/denominator;
+    return t < r.tmax && t > r.tmin;
+  }
+  return false;
+}
+
 void Plane::transform(const Matrix4x4& m)
 {
   onb = Onb(normalize(make_float3(m*make_float4(onb.m_normal, 0.0f))));
@@ -24,6 +24,7 @@ public:
   }
 
   virtual bool intersect(const optix::Ray& r, HitInfo& hit, unsigned int prim_idx) const;
+  virtual bool intersect_any(const optix::Ray& r, unsigned int prim_idx) const;
   virtual void transform(const optix::Matrix4x4& m);
   virtual optix::Aabb compute_bbox() const;
 
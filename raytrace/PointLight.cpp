@@ -36,7 +36,7 @@ bool PointLight::sample(const float3& pos, float3& dir, float3& L) const
     float epsilon = 10e-4;
     Ray r(pos, dir, 0, epsilon, length(light_pos - pos) - epsilon);
     HitInfo hit;
-    return !tracer->trace_to_closest(r, hit);
+    return !tracer->trace_to_any(r, hit);
   }
   return true;
 }
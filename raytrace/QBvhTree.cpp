@@ -0,0 +1,396 @@
+// 02562 Rendering Framework
+// Four-wide bounding volume hierarchy collapsed from a binary BVH
+// [Dammertz et al., Computer Graphics Forum 27(4) 2008].
+// Copyright (c) DTU Informatics 2011
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <optix_world.h>
+#include "AccObj.h"
+#include "HitInfo.h"
+#include "simd_support.h"
+#include "QBvhTree.h"
+
+using namespace std;
+using namespace optix;
+
+namespace
+{
+  // Every level of the tree pushes at most four children and pops one,
+  // and the tree is no deeper than the binary tree it was collapsed from.
+  const unsigned int max_stack = 256;
+
+  // Bounds of empty children, which no ray can enter
+  const float empty_bound = 1.0e37f;
+
+  // Same costs as in the binary build (see BvhTree.cpp)
+  const float traversal_cost = 0.125f;
+  const float intersection_cost = 1.0f;
+
+  Aabb child_bbox(const QBvhNode& node, unsigned int j)
+  {
+    return Aabb(make_float3(node.bounds[0][0][j], node.bounds[0][1][j], node.bounds[0][2][j]),
+                make_float3(node.bounds[1][0][j], node.bounds[1][1][j], node.bounds[1][2][j]));
+  }
+
+  struct QBvhStackEntry
+  {
+    int node;
+    float t;
+  };
+
+#ifdef RT_SSE
+  // Slab test of a ray against the four child boxes of a node (see
+  // BspTree::intersect_min_max). The near and far planes of each slab are
+  // chosen by the sign of the ray direction. If a product is NaN (origin
+  // in a slab plane parallel to the ray), min/max return the running
+  // interval, which leaves that slab out of the test.
+  RT_SSE2_FUNCTION int intersect_children_sse(const QBvhNode& node, const Ray& r, const float3& inv_dir,
+                                              const unsigned int* sign, float* t_near)
+  {
+    __m128 t_min = _mm_set1_ps(r.tmin);
+    __m128 t_max = _mm_set1_ps(r.tmax);
+    for(unsigned int a = 0; a < 3; ++a)
+    {
+      __m128 o = _mm_set1_ps(*(&r.origin.x + a));
+      __m128 inv = _mm_set1_ps(*(&inv_dir.x + a));
+      __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bounds[sign[a]][a]), o), inv);
+      __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bounds[1 - sign[a]][a]), o), inv);
+      t_min = _mm_max_ps(t0, t_min);
+      t_max = _mm_min_ps(t1, t_max);
+    }
+    _mm_storeu_ps(t_near, t_min);
+    return _mm_movemask_ps(_mm_cmple_ps(t_min, t_max));
+  }
+#endif
+}
+
+void QBvhTree::init(const vector<Object3D*>& geometry, const vector<const Plane*>& scene_planes)
+{
+  BvhTree::init(geometry, scene_planes);
+  qnodes.clear();
+  if(nodes.size() == 0)
+    return;
+
+  if(nodes[0].count > 0)
+  {
+    // A single leaf becomes the only child of the root
+    QBvhNode root;
+    for(unsigned int j = 0; j < 4; ++j)
+    {
+      for(unsigned int a = 0; a < 3; ++a)
+      {
+        root.bounds[0][a][j] = j == 0 ? *(&nodes[0].bbox.m_min.x + a) : empty_bound;
+        root.bounds[1][a][j] = j == 0 ? *(&nodes[0].bbox.m_max.x + a) : -empty_bound;
+      }
+      root.child[j] = j == 0 ? static_cast<int>(nodes[0].offset) : -1;
+      root.count[j] = j == 0 ? nodes[0].count : 0;
+    }
+    qnodes.push_back(root);
+  }
+  else
+    collapse(0);
+
+  // The binary nodes are not needed for traversal
+  vector<BvhNode>().swap(nodes);
+  build_cost = sah_cost();
+}
+
+void QBvhTree::refit()
+{
+  if(qnodes.size() == 0 || !refit_primitives())
+  {
+    rebuild();
+    return;
+  }
+  triangles.init(tree_objects);
+
+  // Child nodes are stored after their parent
+  for(unsigned int i = qnodes.size(); i > 0; --i)
+  {
+    QBvhNode& node = qnodes[i - 1];
+    for(unsigned int j = 0; j < 4; ++j)
+    {
+      if(node.count[j] > 0)
+        set_child_bbox(node, j, leaf_bbox(node.child[j], node.count[j]));
+      else if(node.child[j] >= 0)
+      {
+        const QBvhNode& child = qnodes[node.child[j]];
+        Aabb bbox;
+        for(unsigned int k = 0; k < 4; ++k)
+          if(child.count[k] > 0 || child.child[k] >= 0)
+            bbox.include(child_bbox(child, k));
+        set_child_bbox(node, j, bbox);
+      }
+    }
+  }
+  if(sah_cost() > max_cost_growth*build_cost)
+    rebuild();
+}
+
+bool QBvhTree::closest_hit(Ray& r, HitInfo& hit) const
+{
+  if(qnodes.size() == 0)
+  {
+    closest_plane(r, hit);
+    return hit.has_hit;
+  }
+
+  float3 inv_dir = make_float3(1.0f)/r.direction;
+  unsigned int sign[3] = { inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f };
+  QBvhStackEntry stack[max_stack];
+  unsigned int stack_size = 0;
+  stack[stack_size].node = 0;
+  stack[stack_size++].t = r.tmin;
+
+  // The hit info of the closest triangle is filled in after traversal
+  int closest = -1;
+  float closest_beta = 0.0f;
+  float closest_gamma = 0.0f;
+  while(stack_size > 0)
+  {
+    QBvhStackEntry entry = stack[--stack_size];
+    if(entry.t > r.tmax)
+      continue;
+
+    const QBvhNode& node = qnodes[entry.node];
+    RT_COUNT(nodes, 1);
+    float t_near[4];
+    int hits = intersect_children(node, r, inv_dir, sign, t_near);
+    if(hits == 0)
+      continue;
+
+    // Sort the children that were hit from near to far
+    unsigned int order[4];
+    unsigned int no_of_hits = 0;
+    for(unsigned int j = 0; j < 4; ++j)
+    {
+      if((hits & (1 << j)) == 0)
+        continue;
+      unsigned int k = no_of_hits++;
+      for(; k > 0 && t_near[order[k - 1]] > t_near[j]; --k)
+        order[k] = order[k - 1];
+      order[k] = j;
+    }
+
+    // Intersect leaves right away to shorten the ray, then push the child
+    // nodes so that the nearest one is visited next
+    for(unsigned int k = 0; k < no_of_hits; ++k)
+    {
+      unsigned int j = order[k];
+      if(node.count[j] > 0 && t_near[j] <= r.tmax)
+        intersect_leaf(r, hit, node.child[j], node.count[j], closest, closest_beta, closest_gamma);
+    }
+    for(unsigned int k = no_of_hits; k > 0; --k)
+    {
+      unsigned int j = order[k - 1];
+      if(node.count[j] == 0)
+      {
+        stack[stack_size].node = node.child[j];
+        stack[stack_size++].t = t_near[j];
+      }
+    }
+  }
+  if(closest >= 0)
+    fill_hit_info(r, hit, closest, closest_beta, closest_gamma);
+  closest_plane(r, hit);
+  return hit.has_hit;
+}
+
+bool QBvhTree::any_hit(Ray& r, HitInfo& hit) const
+{
+  if(qnodes.size() == 0)
+    return any_plane(r, hit);
+
+  float3 inv_dir = make_float3(1.0f)/r.direction;
+  unsigned int sign[3] = { inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f };
+  int stack[max_stack];
+  unsigned int stack_size = 0;
+  stack[stack_size++] = 0;
+  while(stack_size > 0)
+  {
+    const QBvhNode& node = qnodes[stack[--stack_size]];
+    RT_COUNT(nodes, 1);
+    float t_near[4];
+    int hits = intersect_children(node, r, inv_dir, sign, t_near);
+    for(unsigned int j = 0; j < 4; ++j)
+    {
+      if((hits & (1 << j)) == 0)
+        continue;
+      if(node.count[j] == 0)
+        stack[stack_size++] = node.child[j];
+      else if(intersect_leaf_any(r, node.child[j], node.count[j]))
+      {
+        hit.has_hit = true;
+        return true;
+      }
+    }
+  }
+  return any_plane(r, hit);
+}
+
+string QBvhTree::describe() const
+{
+  ostringstream ostr;
+  ostr << "Four-wide bounding volume hierarchy (" << qnodes.size() << " nodes, " << leaves << " leaves, max depth "
+       << max_depth << " before collapsing, " << planes.size() << " planes).";
+  return ostr.str();
+}
+
+AccStats QBvhTree::get_stats() const
+{
+  // Leaves are stored in the children of the four-wide nodes
+  AccStats stats;
+  stats.nodes = qnodes.size();
+  stats.primitives = primitives.size();
+  stats.sah_cost = sah_cost();
+  if(qnodes.size() == 0)
+    return stats;
+
+  vector<pair<unsigned int, unsigned int> > stack(1, make_pair(0u, 0u));
+  while(!stack.empty())
+  {
+    const QBvhNode& node = qnodes[stack.back().first];
+    unsigned int depth = stack.back().second;
+    stack.pop_back();
+    for(unsigned int j = 0; j < 4; ++j)
+    {
+      if(node.count[j] > 0)
+      {
+        ++stats.nodes;
+        stats.add_leaf(depth + 1, node.count[j]);
+      }
+      else if(node.child[j] >= 0)
+        stack.push_back(make_pair(static_cast<unsigned int>(node.child[j]), depth + 1));
+    }
+  }
+  return stats;
+}
+
+bool QBvhTree::cpu_has_simd()
+{
+  return cpu_has_sse2();
+}
+
+unsigned int QBvhTree::collapse(unsigned int node_idx)
+{
+  // Gather up to four nodes below a binary node by repeatedly opening the
+  // child node with the largest surface area
+  unsigned int children[4] = { node_idx + 1, nodes[node_idx].offset };
+  unsigned int no_of_children = 2;
+  while(no_of_children < 4)
+  {
+    int largest = -1;
+    float largest_area = -1.0f;
+    for(unsigned int j = 0; j < no_of_children; ++j)
+    {
+      const BvhNode& child = nodes[children[j]];
+      if(child.count == 0 && child.bbox.area() > largest_area)
+      {
+        largest = j;
+        largest_area = child.bbox.area();
+      }
+    }
+    if(largest < 0)
+      break;
+    unsigned int opened = children[largest];
+    children[largest] = opened + 1;
+    children[no_of_children++] = nodes[opened].offset;
+  }
+
+  unsigned int qnode_idx = qnodes.size();
+  qnodes.push_back(QBvhNode());
+  for(unsigned int j = 0; j < 4; ++j)
+  {
+    QBvhNode& qnode = qnodes[qnode_idx];
+    if(j >= no_of_children)
+    {
+      for(unsigned int a = 0; a < 3; ++a)
+      {
+        qnode.bounds[0][a][j] = empty_bound;
+        qnode.bounds[1][a][j] = -empty_bound;
+      }
+      qnode.child[j] = -1;
+      qnode.count[j] = 0;
+      continue;
+    }
+
+    const BvhNode& child = nodes[children[j]];
+    for(unsigned int a = 0; a < 3; ++a)
+    {
+      qnode.bounds[0][a][j] = *(&child.bbox.m_min.x + a);
+      qnode.bounds[1][a][j] = *(&child.bbox.m_max.x + a);
+    }
+    qnode.count[j] = child.count;
+    if(child.count > 0)
+      qnode.child[j] = child.offset;
+    else
+    {
+      // Collapsing the child appends to qnodes, so index it again afterwards
+      int child_idx = collapse(children[j]);
+      qnodes[qnode_idx].child[j] = child_idx;
+    }
+  }
+  return qnode_idx;
+}
+
+void QBvhTree::set_child_bbox(QBvhNode& node, unsigned int j, const Aabb& bbox) const
+{
+  for(unsigned int a = 0; a < 3; ++a)
+  {
+    node.bounds[0][a][j] = *(&bbox.m_min.x + a);
+    node.bounds[1][a][j] = *(&bbox.m_max.x + a);
+  }
+}
+
+float QBvhTree::sah_cost() const
+{
+  // Expected cost of tracing a ray through the tree relative to the
+  // surface area of the root (see BvhTree::sah_cost)
+  float cost = 0.0f;
+  Aabb root_bbox;
+  for(unsigned int i = 0; i < qnodes.size(); ++i)
+  {
+    const QBvhNode& node = qnodes[i];
+    for(unsigned int j = 0; j < 4; ++j)
+    {
+      if(node.count[j] == 0 && node.child[j] < 0)
+        continue;
+      Aabb bbox = child_bbox(node, j);
+      cost += bbox.area()*(node.count[j] > 0 ? node.count[j]*intersection_cost : traversal_cost);
+      if(i == 0)
+        root_bbox.include(bbox);
+    }
+  }
+  float root_area = root_bbox.valid() ? root_bbox.area() : 0.0f;
+  return root_area > 0.0f ? cost/root_area : cost;
+}
+
+int QBvhTree::intersect_children(const QBvhNode& node, const Ray& r, const float3& inv_dir,
+                                 const unsigned int* sign, float* t_near) const
+{
+#ifdef RT_SSE
+  if(simd)
+    return intersect_children_sse(node, r, inv_dir, sign, t_near);
+#endif
+  int hits = 0;
+  for(unsigned int j = 0; j < 4; ++j)
+  {
+    float t_min = r.tmin;
+    float t_max = r.tmax;
+    for(unsigned int a = 0; a < 3; ++a)
+    {
+      float o = *(&r.origin.x + a);
+      float inv = *(&inv_dir.x + a);
+      float t0 = (node.bounds[sign[a]][a][j] - o)*inv;
+      float t1 = (node.bounds[1 - sign[a]][a][j] - o)*inv;
+      t_min = t0 > t_min ? t0 : t_min;
+      t_max = t1 < t_max ? t1 : t_max;
+    }
+    t_near[j] = t_min;
+    if(t_min <= t_max)
+      hits |= 1 << j;
+  }
+  return hits;
+}
@@ -0,0 +1,54 @@
+// 02562 Rendering Framework
+// Four-wide bounding volume hierarchy collapsed from a binary BVH
+// [Dammertz et al., Computer Graphics Forum 27(4) 2008].
+// Copyright (c) DTU Informatics 2011
+
+#ifndef QBVHTREE_H
+#define QBVHTREE_H
+
+#include <vector>
+#include <string>
+#include <optix_world.h>
+#include "AccObj.h"
+#include "Object3D.h"
+#include "Plane.h"
+#include "HitInfo.h"
+#include "BvhTree.h"
+
+struct QBvhNode
+{
+  float bounds[2][3][4];   // [min/max][axis][child], empty children have inverted bounds
+  int child[4];            // index of a child node, first object of a leaf child, or -1 if empty
+  unsigned short count[4]; // number of objects in a leaf child, 0 for child nodes
+};
+
+class QBvhTree : public BvhTree
+{
+public:
+  QBvhTree(unsigned int max_objects_in_leaf = 4, unsigned int no_of_bins = 16)
+    : BvhTree(max_objects_in_leaf, no_of_bins), simd(cpu_has_simd())
+  { }
+
+  virtual void init(const std::vector<Object3D*>& geometry, const std::vector<const Plane*>& planes);
+  virtual bool closest_hit(optix::Ray& r, HitInfo& hit) const;
+  virtual bool any_hit(optix::Ray& r, HitInfo& hit) const;
+  virtual std::string describe() const;
+  virtual AccStats get_stats() const;
+  virtual void refit();
+
+  // The SSE box test is used if the processor supports it
+  void set_simd(bool enable) { simd = enable && cpu_has_simd(); }
+
+private:
+  static bool cpu_has_simd();
+  unsigned int collapse(unsigned int node_idx);
+  void set_child_bbox(QBvhNode& node, unsigned int j, const optix::Aabb& bbox) const;
+  float sah_cost() const;
+  int intersect_children(const QBvhNode& node, const optix::Ray& r, const optix::float3& inv_dir,
+                         const unsigned int* sign, float* t_near) const;
+
+  std::vector<QBvhNode> qnodes;
+  bool simd;
+};
+
+#endif // QBVHTREE_H
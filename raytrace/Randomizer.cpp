@@ -43,18 +43,89 @@
 */
 
 #include "Randomizer.h"
+#include "mt_random.h"
 
 #ifdef _OPENMP
   #include <omp.h>
 #endif
 
-Randomizer randomizer;
+namespace
+{
+  // Generator of the calling thread, see thread_randomizer()
+  Randomizer* thread_rng = 0;
+  #pragma omp threadprivate(thread_rng)
+
+  // Seed of the generator first used by a thread
+  const unsigned long default_seed = 5489UL;
+
+  // Generator type of the threads, see set_random_generator(...). PCG32
+  // is the default, as the renderer reseeds at every tile (and with
+  // PCG32 at every pixel sample), which costs MT19937 a rebuild of its
+  // 624-word state and a regeneration burst each time.
+  RandomGenerator thread_generator = rng_pcg32;
+
+  // Finalizer of the 32-bit MurmurHash3, which spreads a small change
+  // of the input over all bits of the output
+  unsigned int mix_bits(unsigned int h)
+  {
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+  }
+}
+
+Randomizer& thread_randomizer()
+{
+  if(!thread_rng)
+  {
+#ifdef _OPENMP
+    thread_rng = new Randomizer(default_seed + omp_get_thread_num(), thread_generator);
+#else
+    thread_rng = new Randomizer(default_seed, thread_generator);
+#endif
+  }
+  return *thread_rng;
+}
+
+void seed_thread_randomizer(unsigned long seed, unsigned int tile, unsigned int pass)
+{
+  unsigned int h = mix_bits(static_cast<unsigned int>(seed) ^ 0x9e3779b9U);
+  h = mix_bits(h ^ tile);
+  h = mix_bits(h ^ pass);
+  thread_randomizer().set_generator(thread_generator, h);
+}
+
+void seek_thread_randomizer(unsigned long seed, unsigned int pixel, unsigned int sample)
+{
+  Randomizer& rng = thread_randomizer();
+  if(rng.get_generator() != thread_generator)
+    rng.set_generator(thread_generator);
+  rng.seek(seed, pixel, sample);
+}
+
+void set_random_generator(RandomGenerator type)
+{
+  thread_generator = type;
+}
+
+RandomGenerator get_random_generator()
+{
+  return thread_generator;
+}
 
 const int Randomizer::N = 624;
 const int Randomizer::M = 397;
 
 void Randomizer::init(unsigned long seed)
 {
+  if(generator == rng_pcg32)
+  {
+    pcg.seed(seed, 0);
+    return;
+  }
   mt.resize(N);
   mt[0] = seed & 0xffffffffUL;
   for(mti = 1; mti < N; mti++) 
@@ -69,13 +140,27 @@ void Randomizer::init(unsigned long seed)
   }  
 }
 
-Randomizer::Randomizer(unsigned long seed)
+Randomizer::Randomizer(unsigned long seed, RandomGenerator type)
+  : mti(0), generator(type)
 {
-#ifdef _OPENMP
-  init(seed + omp_get_thread_num());
-#else
   init(seed);
-#endif
+}
+
+void Randomizer::seek(unsigned long seed, unsigned int pixel, unsigned int sample, unsigned int dimension)
+{
+  // Every pixel has a stream of its own, in which every sample starts
+  // 2^32 numbers after the previous one
+  unsigned int h = mix_bits(static_cast<unsigned int>(seed) ^ 0x9e3779b9U);
+  if(generator == rng_pcg32)
+  {
+    pcg.seed(h, pixel);
+    pcg.advance((static_cast<unsigned long long>(sample) << 32) + dimension);
+    return;
+  }
+  h = mix_bits(h ^ pixel);
+  init(mix_bits(h ^ sample));
+  for(unsigned int i = 0; i < dimension; ++i)
+    mt_random_int32();
 }
 
 unsigned long Randomizer::mt_random_int32()
@@ -86,6 +171,9 @@ unsigned long Randomizer::mt_random_int32()
     static const unsigned long mag01[2] = {0x0UL, 0x9908b0dfUL};
     /* mag01[x] = x * MATRIX_A  for x=0,1 */
 
+    if(generator == rng_pcg32)
+      return pcg.next_uint();
+
     if(mti >= N) /* generate N words at one time */
     {
       int kk;
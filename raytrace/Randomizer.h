@@ -3,11 +3,19 @@
 
 #include <valarray>
 #include <ctime>
+#include "Pcg32.h"
+
+// MT19937 has a period of 2^19937 - 1 but 2.5 KB of state that is
+// regenerated in bursts of 624 numbers. PCG32 has 16 bytes of state and
+// can jump to any position of its stream, which makes it cheap to start
+// the numbers of every pixel sample at a position of their own.
+enum RandomGenerator { rng_mt19937, rng_pcg32 };
 
 class Randomizer
 {
 public:
-  Randomizer(unsigned long seed = 5489UL + static_cast<unsigned long>(std::time(0)));
+  Randomizer(unsigned long seed = 5489UL + static_cast<unsigned long>(std::time(0)),
+             RandomGenerator type = rng_mt19937);
 
   /* generates a random number on [0,0xffffffff]-interval */
   unsigned long mt_random_int32();
@@ -21,14 +29,25 @@ public:
   /* generates a random number on (0,1)-real-interval */
   double mt_random_open();
 
-  // Randomizer.cpp defines a global instance, this potentially
-  // leads to problems if used with constructors for other global 
-  // variables. The safe_mt_random function checks if initalization
-  // is needed before computing the random number.
-  double safe_mt_random() { if(mt.size() == 0) init(); return mt_random(); }
+  // A global instance potentially leads to problems if used with
+  // constructors for other global variables. The safe_mt_random
+  // function checks if initalization is needed before computing
+  // the random number.
+  double safe_mt_random() { if(generator == rng_mt19937 && mt.size() == 0) init(); return mt_random(); }
 
   void init(unsigned long seed = 5489UL);
 
+  // Moves to number 'dimension' of the numbers drawn for a sample of a
+  // pixel. The position only depends on the arguments. MT19937 cannot
+  // jump, so it is seeded from a hash of the pixel and sample instead
+  // and skips ahead one number at the time.
+  void seek(unsigned long seed, unsigned int pixel, unsigned int sample, unsigned int dimension = 0);
+
+  // Switches the generator type and seeds the new generator, so that it
+  // never draws from a state it has not set up
+  void set_generator(RandomGenerator type, unsigned long seed = 5489UL) { generator = type; init(seed); }
+  RandomGenerator get_generator() const { return generator; }
+
 private:
   static const int N;
   static const int M;
@@ -36,6 +55,9 @@ private:
   /* the array for the state vector  */
   std::valarray<unsigned int> mt; 
   int mti;                        
+
+  Pcg32 pcg;
+  RandomGenerator generator;
 };
 
 #endif
@@ -5,6 +5,7 @@
 #include <iostream>
 #include <optix_world.h>
 #include "mt_random.h"
+#include "PixelSampler.h"
 #include "Shader.h"
 #include "HitInfo.h"
 #include "RayCaster.h"
@@ -35,11 +36,13 @@ float3 RayCaster::compute_pixel(unsigned int x, unsigned int y) const
   float3 result = make_float3(0.0f);
   int rays_per_pixel = jitter.size();
   for(int i = 0; i < rays_per_pixel; i++){
-    float2 ip_coords = make_float2(x,y)*win_to_ip + lower_left + jitter.at(i);;
+    float2 ip_coords = make_float2(x,y)*win_to_ip + lower_left + get_jitter(x, y, i);
     Ray r = scene->get_camera()->get_ray(ip_coords);
     HitInfo hit;
     if(scene->closest_hit(r, hit)){
+      begin_pixel_sample(x, y, i, 2);
       result += get_shader(hit)->shade(r, hit);
+      end_pixel_sample();
     } else {
       result += get_background(r.direction);
     }
@@ -49,6 +52,69 @@ float3 RayCaster::compute_pixel(unsigned int x, unsigned int y) const
   return result/(float)rays_per_pixel;
 }
 
+void RayCaster::compute_tile(unsigned int x0, unsigned int y0, unsigned int w, unsigned int h,
+                             float3* colors, unsigned int stride) const
+{
+  unsigned int n = w*h;
+  if(n > max_packet_size)
+  {
+    for(unsigned int j = 0; j < h; ++j)
+      for(unsigned int i = 0; i < w; ++i)
+        colors[j*stride + i] = compute_pixel(x0 + i, y0 + j);
+    return;
+  }
+
+  Ray rays[max_packet_size];
+  HitInfo hits[max_packet_size];
+  float3 result[max_packet_size];
+  for(unsigned int k = 0; k < n; ++k)
+    result[k] = make_float3(0.0f);
+
+  // Samples are accumulated in the same order as in compute_pixel(...)
+  int rays_per_pixel = jitter.size();
+  for(int s = 0; s < rays_per_pixel; ++s)
+  {
+    get_tile_rays(x0, y0, w, h, s, rays);
+    for(unsigned int k = 0; k < n; ++k)
+      hits[k] = HitInfo();
+    scene->closest_hit_packet(rays, hits, n);
+    for(unsigned int k = 0; k < n; ++k)
+    {
+      if(hits[k].has_hit)
+      {
+        begin_pixel_sample(x0 + k%w, y0 + k/w, s, 2);
+        result[k] += get_shader(hits[k])->shade(rays[k], hits[k]);
+        end_pixel_sample();
+      }
+      else
+        result[k] += get_background(rays[k].direction);
+    }
+  }
+  for(unsigned int j = 0; j < h; ++j)
+    for(unsigned int i = 0; i < w; ++i)
+      colors[j*stride + i] = result[j*w + i]/(float)rays_per_pixel;
+}
+
+void RayCaster::get_tile_rays(unsigned int x0, unsigned int y0, unsigned int w, unsigned int h,
+                              unsigned int sample, Ray* rays) const
+{
+  for(unsigned int j = 0; j < h; ++j)
+    for(unsigned int i = 0; i < w; ++i)
+    {
+      float2 ip_coords = make_float2(x0 + i, y0 + j)*win_to_ip + lower_left + get_jitter(x0 + i, y0 + j, sample);
+      rays[j*w + i] = scene->get_camera()->get_ray(ip_coords);
+    }
+}
+
+float2 RayCaster::get_jitter(unsigned int x, unsigned int y, unsigned int sample) const
+{
+  const PixelSampler* sampler = get_pixel_sampler();
+  if(!sampler)
+    return jitter.at(sample);
+  float2 offset = make_float2(sampler->sample(x, y, sample, 0), sampler->sample(x, y, sample, 1));
+  return (offset - 0.5f)*win_to_ip;
+}
+
 float3 RayCaster::get_background(const float3& dir) const
 { 
   if(!sphere_tex)
@@ -80,8 +146,10 @@ void RayCaster::compute_jitters()
   lower_left = (win_to_ip - make_float2(aspect, 1.0f))*0.5f;
   step = win_to_ip/static_cast<float>(subdivs);
 
+  // The jitters have their own generator, so they are the same in every run
+  Randomizer jitter_randomizer(5489UL);
   jitter.resize(subdivs*subdivs);
   for(unsigned int i = 0; i < subdivs; ++i)
     for(unsigned int j = 0; j < subdivs; ++j)
-      jitter[i*subdivs + j] = make_float2(safe_mt_random() + j, safe_mt_random() + i)*step - win_to_ip*0.5f; 
+      jitter[i*subdivs + j] = make_float2(jitter_randomizer.mt_random() + j, jitter_randomizer.mt_random() + i)*step - win_to_ip*0.5f; 
 }
@@ -21,10 +21,27 @@ public:
   
   virtual optix::float3 compute_pixel(unsigned int x, unsigned int y) const;
 
+  // Computes the colors of a tile of at most max_packet_size pixels with
+  // lower left pixel (x0, y0) by tracing the rays of each jitter sample as
+  // one packet. The color of pixel (x0 + i, y0 + j) is stored in
+  // colors[j*stride + i]. The result is the same as from compute_pixel(...).
+  virtual void compute_tile(unsigned int x0, unsigned int y0, unsigned int w, unsigned int h,
+                            optix::float3* colors, unsigned int stride) const;
+
+  // Eye rays through the pixels of a tile for the given jitter sample
+  void get_tile_rays(unsigned int x0, unsigned int y0, unsigned int w, unsigned int h,
+                     unsigned int sample, optix::Ray* rays) const;
+
+  // Offset from the center of pixel (x, y) in the image plane of the
+  // given jitter sample. Without a pixel sampler, every pixel uses the
+  // same stratified jitters.
+  optix::float2 get_jitter(unsigned int x, unsigned int y, unsigned int sample) const;
+
   void set_background(const optix::float3& color) { background = color; }
   void set_background(SphereTexture* sphere_texture) { sphere_tex = sphere_texture; }
   const optix::float3& get_background() const { return background; }
   optix::float3 get_background(const optix::float3& direction) const;
+  virtual void set_resolution(unsigned int w, unsigned int h) { Tracer::set_resolution(w, h); compute_jitters(); }
   void increment_pixel_subdivs();
   void decrement_pixel_subdivs();
 
@@ -3,6 +3,11 @@
 // Copyright (c) DTU Informatics 2011
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstdio>
 #include <algorithm>
 #include <list>
 #include <string>
@@ -28,6 +33,47 @@ RenderEngine render_engine;
 
 namespace
 {
+  // Side length in pixels of the tiles traced as ray packets
+  const unsigned int tile_size = 8;
+
+  // Grid spacing in pixels of the first progressive preview pass
+  const unsigned int preview_grid = 8;
+
+  // Names of the acceleration data structures in the order of AcceleratorType
+  const char* accelerator_names[] = { "brute", "bsp", "bvh", "qbvh", "sbvh", "cbvh" };
+  const unsigned int no_of_accelerators = sizeof(accelerator_names)/sizeof(accelerator_names[0]);
+
+  const char* batch_usage =
+    "Usage: raytrace --batch [options] [scene files]\n"
+    "  -v <file>   view file saved with 'S' in the interactive mode\n"
+    "  -s <n>      shader number as selected with the number keys (default 0)\n"
+    "  -n <spp>    path trace this many samples per pixel (default: one ray tracing pass as with 'r')\n"
+    "  -e <error>  stop path tracing tiles when their error estimate is below this threshold\n"
+    "  -r <WxH>    render resolution (default 512x512)\n"
+    "  -o <file>   output PNG file (default named after the last scene file)\n"
+    "  -t <n>      render n frames of a turntable, numbered in the file names\n"
+    "  -a <name>   acceleration data structure: brute, bsp, bvh (default), qbvh,\n"
+    "              sbvh (spatial splits) or cbvh (compressed)\n"
+    "  -b <name>   print a benchmark instead of rendering: packets, random or\n"
+    "              sbvh (spatial against object splits)\n"
+    "Scene files are OBJ meshes or .inst files that place instances of meshes\n"
+    "(see RenderEngine::load_instances).\n"
+    "The image is gamma corrected before it is stored. Set OMP_NUM_THREADS to\n"
+    "limit the number of threads when running several renders side by side.\n";
+
+  // Special rules for placing some meshes, given the lower case file name
+  // without path
+  Matrix4x4 mesh_transform(const string& filename)
+  {
+    if(char_traits<char>::compare(filename.c_str(), "cornell", 7) == 0)
+      return Matrix4x4::scale(make_float3(0.025f))*Matrix4x4::rotate(M_PIf, make_float3(0.0f, 1.0f, 0.0f));
+    else if(char_traits<char>::compare(filename.c_str(), "bunny", 5) == 0)
+      return Matrix4x4::translate(make_float3(-3.0f, -0.85f, -8.0f))*Matrix4x4::scale(make_float3(25.0f));
+    else if(char_traits<char>::compare(filename.c_str(), "justelephant", 12) == 0)
+      return Matrix4x4::translate(make_float3(-10.0f, 3.0f, -2.0f))*Matrix4x4::rotate(0.5f, make_float3(0.0f, 1.0f, 0.0f));
+    return Matrix4x4::identity();
+  }
+
   // String utilities
 	void lower_case(char& x) { x = tolower(x); }
 
@@ -35,6 +81,22 @@ namespace
 	{
     for_each(s.begin(), s.end(), lower_case);
 	}
+
+  // Lower case file name without path
+  string file_name_without_path(const string& path)
+  {
+    list<string> path_split;
+    split(path, path_split, "\\");
+    string name = path_split.back();
+    if(name.find("/") != name.npos)
+    {
+      path_split.clear();
+      split(name, path_split, "/");
+      name = path_split.back();
+    }
+    lower_case_string(name);
+    return name;
+  }
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -44,17 +106,28 @@ namespace
 RenderEngine::RenderEngine() 
   : win(optix::make_uint2(512, 512)),                        // Default window size
     res(optix::make_uint2(512, 512)),                        // Default render resolution
-    image(res.x*res.y),
+    image(res.x, res.y, 64),                                 // Side length in pixels of the blocks in which the image is stored
     image_tex(0),
+    tex_res(optix::make_uint2(0, 0)),
+    preview_step(0),
     mouse_state(GLUT_UP),
     spin_timer(20),
     vctrl(0),
+    turntable_center(optix::make_float3(0.0f)),
     scene(&cam),
+    acc_type(acc_bvh),                                       // Acceleration data structure (switched with 'a' or the batch option -a)
     filename("out.ppm"),                                     // Default output file name
     tracer(res.x, res.y, &scene, 100000),                    // Maximum number of photons in map
     max_to_trace(500000),                                    // Maximum number of photons to trace
     caustics_particles(40000),                               // Desired number of caustics photons
     done(false), 
+    scheduler(16),                                           // Side length in pixels of the tiles given to the render threads
+    adaptive(0.05f, 16),                                     // Error threshold of adaptive sampling and samples per pixel before a tile can converge
+    seed(5489),                                              // Seed of the random numbers used for rendering
+    sobol_sampler(seed),
+    halton_sampler(seed),
+    blue_noise_sampler(seed, 64),                            // Side length in pixels of the blue-noise mask
+    current_sampler(0),                                      // Pixel sampler used for rendering (0 is independent random numbers)
     light_pow(optix::make_float3(M_PIf)),                    // Power of the default light
     light_dir(optix::make_float3(-1.0f)),                    // Direction of the default light
     default_light(&tracer, light_pow, light_dir),            // Construct default light
@@ -79,6 +152,12 @@ RenderEngine::RenderEngine()
   shaders.push_back(&lambertian);                            // number key 1 (direct lighting)
   shaders.push_back(&photon_caustics);                       // number key 2 (photon map caustics)
   shaders.push_back(&mc_glossy);                             // number key 3 (path tracing shader)
+  scheduler.init(res.x, res.y);
+  adaptive.init(scheduler, res.x, res.y);
+  pixel_samplers.push_back(0);                               // key 'M' cycles through the pixel samplers
+  pixel_samplers.push_back(&sobol_sampler);
+  pixel_samplers.push_back(&halton_sampler);
+  pixel_samplers.push_back(&blue_noise_sampler);
 }
 
 RenderEngine::~RenderEngine()
@@ -92,29 +171,16 @@ void RenderEngine::load_files(int argc, char** argv)
   {
     for(int i = 1; i < argc; ++i)
     {
-      // Retrieve filename without path
-      list<string> path_split;
-      split(argv[i], path_split, "\\");
-      filename = path_split.back();
-      if(filename.find("/") != filename.npos)
-      {
-        path_split.clear();
-        split(filename, path_split, "/");
-        filename = path_split.back();
-      }
-      lower_case_string(filename);
-      Matrix4x4 transform = Matrix4x4::identity();
-
-      // Special rules for some meshes
-      if(char_traits<char>::compare(filename.c_str(), "cornell", 7) == 0)
-        transform = Matrix4x4::scale(make_float3(0.025f))*Matrix4x4::rotate(M_PIf, make_float3(0.0f, 1.0f, 0.0f));
-      else if(char_traits<char>::compare(filename.c_str(), "bunny", 5) == 0)
-        transform = Matrix4x4::translate(make_float3(-3.0f, -0.85f, -8.0f))*Matrix4x4::scale(make_float3(25.0f));
-      else if(char_traits<char>::compare(filename.c_str(), "justelephant", 12) == 0)
-        transform = Matrix4x4::translate(make_float3(-10.0f, 3.0f, -2.0f))*Matrix4x4::rotate(0.5f, make_float3(0.0f, 1.0f, 0.0f));
-     
-      // Load the file into the scene
-      scene.load_mesh(argv[i], transform);
+      filename = file_name_without_path(argv[i]);
+
+      // Load the file into the scene. Instance files place meshes that
+      // share geometry and a bottom-level BVH.
+      list<string> dot_split;
+      split(filename, dot_split, ".");
+      if(dot_split.back() == "inst")
+        load_instances(argv[i]);
+      else
+        scene.load_mesh(argv[i], mesh_transform(filename));
     }
     init_view();
   }
@@ -135,6 +201,48 @@ void RenderEngine::load_files(int argc, char** argv)
   }
 }
 
+void RenderEngine::load_instances(const string& inst_file)
+{
+  ifstream ifs(inst_file.c_str());
+  if(!ifs)
+  {
+    cerr << "Error: Could not open instance file " << inst_file << endl;
+    return;
+  }
+  string dir;
+  size_t slash = inst_file.find_last_of("/\\");
+  if(slash != inst_file.npos)
+    dir = inst_file.substr(0, slash + 1);
+
+  unsigned int no_of_instances = 0;
+  string line;
+  for(unsigned int line_no = 1; getline(ifs, line); ++line_no)
+  {
+    istringstream iss(line);
+    string mesh_file;
+    if(!(iss >> mesh_file) || mesh_file[0] == '#')
+      continue;
+    float3 position;
+    float angle = 0.0f;
+    float scale = 1.0f;
+    if(!(iss >> position.x >> position.y >> position.z))
+    {
+      cerr << "Error: No position in line " << line_no << " of " << inst_file << endl;
+      continue;
+    }
+    if(iss >> angle)
+      iss >> scale;
+    if(mesh_file[0] != '/' && mesh_file[0] != '\\' && mesh_file.find(':') == mesh_file.npos)
+      mesh_file = dir + mesh_file;
+
+    // The special rules place the mesh before the instance transform
+    Matrix4x4 transform = Matrix4x4::translate(position)*Matrix4x4::rotate(angle, make_float3(0.0f, 1.0f, 0.0f))*Matrix4x4::scale(make_float3(scale));
+    scene.add_instance(mesh_file, transform, mesh_transform(file_name_without_path(mesh_file)));
+    ++no_of_instances;
+  }
+  cout << "Added " << no_of_instances << " instances from " << inst_file << endl;
+}
+
 void RenderEngine::init_GLUT(int argc, char** argv)
 {
   glutInit(&argc, argv);
@@ -161,6 +269,7 @@ void RenderEngine::init_view()
   float3 c;
   float r;
   scene.get_bsphere(c, r);
+  turntable_center = c;
   r *= 1.75f;
 
   // Initialize track ball
@@ -217,32 +326,101 @@ void RenderEngine::init_tracer()
     scene.add_light(&default_light);
   }
 
-  // Build acceleration data structure
-  Timer timer;
-  cout << "Building acceleration structure...";
-  timer.start();
-  scene.init_accelerator();
-  timer.stop();
-  cout << "(time: " << timer.get_time() << ")" << endl; 
+  build_accelerator();
 
   // Build photon maps
+  Timer timer;
   cout << "Building photon maps... " << endl;
   timer.start();
   tracer.build_maps(caustics_particles, max_to_trace);
   timer.stop();
   cout << "Building time: " << timer.get_time() << endl;
+
+  // The background and the photon maps change what the shaders return
+  scene.redo_shading();
+}
+
+void RenderEngine::build_accelerator()
+{
+  // The tree built for loaded meshes is kept in a file named after the
+  // mesh and reused if the scene is unchanged in the next run
+  string cache_name;
+  if(!scene.get_meshes().empty())
+  {
+    list<string> dot_split;
+    split(filename, dot_split, ".");
+    cache_name = dot_split.front() + ".bvh";
+  }
+  Timer timer;
+  cout << "Building acceleration structure...";
+  timer.start();
+  scene.init_accelerator(acc_type, cache_name);
+  timer.stop();
+  cout << "(time: " << timer.get_time() << ")" << endl; 
+  cout << scene.get_accelerator()->describe() << endl;
+  cout << scene.get_accelerator()->get_stats().describe() << endl;
+}
+
+void RenderEngine::next_accelerator()
+{
+  acc_type = static_cast<AcceleratorType>((acc_type + 1)%no_of_accelerators);
+  cout << "Acceleration data structure: " << accelerator_names[acc_type] << endl;
+  build_accelerator();
+  clear_image();
+  done = false;
 }
 
 void RenderEngine::init_texture()
 {
+  if(headless())
+    return;
   if(!glIsTexture(image_tex))
+  {
     glGenTextures(1, &image_tex);
+    tex_res = make_uint2(0, 0);
+  }
   glBindTexture(GL_TEXTURE_2D, image_tex);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 
-  // load the texture image
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, res.x, res.y, 0, GL_RGB, GL_FLOAT, &image[0].x);
+  // Allocate the texture when the resolution changes and otherwise only
+  // load the blocks of the image that changed since the last time
+  if(tex_res.x != res.x || tex_res.y != res.y)
+  {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, res.x, res.y, 0, GL_RGB, GL_FLOAT, 0);
+    tex_res = res;
+    image.mark_all_dirty();
+  }
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, image.get_block_side());
+  for(unsigned int b = 0; b < image.get_no_of_blocks(); ++b)
+  {
+    if(!image.is_dirty(b))
+      continue;
+    unsigned int x, y, w, h;
+    image.get_block_area(b, x, y, w, h);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGB, GL_FLOAT, &image.get_block(b)[0].x);
+  }
+  image.clear_dirty();
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+void RenderEngine::set_resolution(unsigned int w, unsigned int h)
+{
+  res = make_uint2(w, h);
+  image.resize(w, h);
+  tracer.set_resolution(w, h);
+  scheduler.init(w, h);
+  adaptive.init(scheduler, w, h);
+  clear_image();
+  done = false;
+}
+
+void RenderEngine::scale_resolution(float scale)
+{
+  unsigned int w = std::max(static_cast<unsigned int>(res.x*scale + 0.5f), 1u);
+  unsigned int h = std::max(static_cast<unsigned int>(res.y*scale + 0.5f), 1u);
+  set_resolution(w, h);
+  cout << "Render resolution: " << w << "x" << h << endl;
 }
 
 
@@ -252,16 +430,18 @@ void RenderEngine::init_texture()
 
 void RenderEngine::clear_image()
 {
-  std::fill(&image[0], &image[0] + res.x*res.y, make_float3(0.0f));
+  image.clear();
   sample_number = 0.0f;
   split_time = 0.0;
+  adaptive.clear();
+  preview_step = headless() ? 0 : preview_grid;
 }
 
 void RenderEngine::apply_tone_map()
 {
   if(done)
   {
-    tone_map.apply(&image[0].x, res.x, res.y, 3);
+    image.apply(tone_map);
     init_texture();
     glutPostRedisplay();
   }
@@ -271,7 +451,7 @@ void RenderEngine::unapply_tone_map()
 {
   if(done)
   {
-    tone_map.unapply(&image[0].x, res.x, res.y, 3);
+    image.unapply(tone_map);
     init_texture();
     glutPostRedisplay();
   }
@@ -290,6 +470,84 @@ void RenderEngine::add_textures()
   scene.textures_on();
 }
 
+void RenderEngine::preview()
+{
+  // The first sample of the pixels is traced in passes on grids of every
+  // 8th, 4th, 2nd and finally every pixel, each pass skipping the pixels
+  // of the coarser grids. A pixel fills the square up to the next pixel of
+  // its grid, so every pass is a complete image with pixels of the size of
+  // the grid spacing. The last pass gives the same image as a sample pass.
+  unsigned int step = preview_step;
+  unsigned int level = 0;
+  while((preview_grid >> level) > step)
+    ++level;
+  bool seek_pixels = get_random_generator() == rng_pcg32;
+  unsigned int no_of_tiles = scheduler.get_no_of_tiles();
+  Timer pass_timer;
+  pass_timer.start();
+  scheduler.start();
+  #pragma omp parallel
+  {
+    unsigned int t;
+    while(scheduler.next_tile(t))
+    {
+      Timer tile_timer;
+      tile_timer.start();
+      seed_thread_randomizer(seed, t + level*no_of_tiles, 1);
+      const RenderTile& tile = scheduler.get_tile(t);
+      unsigned int x0 = (tile.x + step - 1)/step*step;
+      unsigned int y0 = (tile.y + step - 1)/step*step;
+      for(unsigned int j = y0; j < tile.y + tile.h; j += step)
+        for(unsigned int i = x0; i < tile.x + tile.w; i += step)
+        {
+          if(step < preview_grid && i%(2*step) == 0 && j%(2*step) == 0)
+            continue;
+          unsigned int p = i + j*res.x;
+          if(seek_pixels)
+            seek_thread_randomizer(seed, p, 1);
+          float3& pixel = image.at(i, j);
+          adaptive.add_sample(p, tracer.compute_sample(i, j, 0), pixel, 0);
+          for(unsigned int y = j; y < std::min(j + step, tile.y + tile.h); ++y)
+            for(unsigned int x = i; x < std::min(i + step, tile.x + tile.w); ++x)
+              image.at(x, y) = pixel;
+        }
+      if(step == 1)
+        adaptive.finish_tile(t, tile, image);
+      tile_timer.stop();
+      scheduler.finish_tile(t, tile_timer.get_time());
+    }
+  }
+  pass_timer.stop();
+  scheduler.stop(pass_timer.get_time());
+  image.mark_all_dirty();
+  split_time += pass_timer.get_time();
+  preview_step /= 2;
+  if(preview_step == 0)
+  {
+    adaptive.update_active();
+    ++sample_number;
+  }
+
+  if(headless())
+    return;
+  init_texture();
+  glutPostRedisplay();
+}
+
+void RenderEngine::turn_scene(float angle)
+{
+  // Moving the geometry only refits the acceleration structure, but the
+  // photon maps are traced anew
+  Timer timer;
+  timer.start();
+  scene.turn(turntable_center, angle);
+  timer.stop();
+  cout << "Turned the scene " << angle*180.0f/M_PIf << " degrees, refit time: " << timer.get_time() << endl;
+  tracer.build_maps(caustics_particles, max_to_trace);
+  clear_image();
+  done = false;
+}
+
 void RenderEngine::readjust_camera()
 {
   float3 eye, lookat, up;
@@ -300,26 +558,191 @@ void RenderEngine::readjust_camera()
 void RenderEngine::render()
 {
   cout << "Raytracing";
+#ifdef RT_TRAVERSAL_STATS
+  reset_traversal_stats();
+#endif
   Timer timer;
   timer.start();
-  #pragma omp parallel for private(randomizer)
-  for(int y = 0; y < static_cast<int>(res.y); ++y)
+  unsigned int dot_interval = std::max(scheduler.get_no_of_tiles()/10, 1u);
+  scheduler.start();
+  #pragma omp parallel
   {
-    for(int x = 0; x < static_cast<int>(res.x); ++x)
-      image.at(y * res.x + x) = tracer.compute_pixel(x,y);
-
-    if(((y + 1) % 50) == 0) 
-      cerr << ".";
+    unsigned int t;
+    while(scheduler.next_tile(t))
+    {
+      Timer tile_timer;
+      tile_timer.start();
+      seed_thread_randomizer(seed, t, 0);
+      const RenderTile& tile = scheduler.get_tile(t);
+      float3 colors[tile_size*tile_size];
+      for(unsigned int y = tile.y; y < tile.y + tile.h; y += tile_size)
+      {
+        unsigned int h = std::min(tile_size, tile.y + tile.h - y);
+        for(unsigned int x = tile.x; x < tile.x + tile.w; x += tile_size)
+        {
+          unsigned int w = std::min(tile_size, tile.x + tile.w - x);
+          tracer.compute_tile(x, y, w, h, colors, tile_size);
+          for(unsigned int j = 0; j < h; ++j)
+            for(unsigned int i = 0; i < w; ++i)
+              image.at(x + i, y + j) = colors[j*tile_size + i];
+        }
+      }
+      tile_timer.stop();
+      if(scheduler.finish_tile(t, tile_timer.get_time()) % dot_interval == 0)
+        cerr << ".";
+    }
   }
   timer.stop();
+  scheduler.stop(timer.get_time());
+  image.mark_all_dirty();
   cout << " - " << timer.get_time() << " secs " << endl;
+  cout << scheduler.describe() << endl;
+#ifdef RT_TRAVERSAL_STATS
+  cout << gather_traversal_stats().describe() << endl;
+#endif
 
   init_texture();
   done = true;
 }
 
+double RenderEngine::trace_eye_rays(bool packets, int& no_of_hits)
+{
+  // Trace the eye rays through the pixel centers of the image without
+  // shading, one by one or as tile packets, and return the time taken
+  int no_of_bands = (res.y + tile_size - 1)/tile_size;
+  Timer timer;
+  timer.start();
+  int hits = 0;
+  #pragma omp parallel for reduction(+:hits)
+  for(int b = 0; b < no_of_bands; ++b)
+  {
+    Ray rays[max_packet_size];
+    HitInfo hit_info[max_packet_size];
+    unsigned int y = b*tile_size;
+    unsigned int h = std::min(tile_size, res.y - y);
+    for(unsigned int x = 0; x < res.x; x += tile_size)
+    {
+      unsigned int w = std::min(tile_size, res.x - x);
+      tracer.get_tile_rays(x, y, w, h, 0, rays);
+      for(unsigned int k = 0; k < w*h; ++k)
+        hit_info[k] = HitInfo();
+      if(packets)
+        scene.closest_hit_packet(rays, hit_info, w*h);
+      else
+        for(unsigned int k = 0; k < w*h; ++k)
+          scene.closest_hit(rays[k], hit_info[k]);
+      for(unsigned int k = 0; k < w*h; ++k)
+        hits += hit_info[k].has_hit;
+    }
+  }
+  timer.stop();
+  no_of_hits = hits;
+  return timer.get_time();
+}
+
+void RenderEngine::benchmark_packets()
+{
+  // Compare the throughput of eye rays traced one by one and as packets
+  double no_of_rays = static_cast<double>(res.x)*res.y;
+  double times[2];
+  int hits[2] = { 0, 0 };
+  for(unsigned int packets = 0; packets < 2; ++packets)
+    times[packets] = trace_eye_rays(packets != 0, hits[packets]);
+  cout << "Eye rays: " << no_of_rays << ", hits: " << hits[0] << " single, " << hits[1] << " packets" << endl
+       << "Single rays: " << no_of_rays*1.0e-6/times[0] << " Mrays/s" << endl
+       << tile_size << "x" << tile_size << " packets: " << no_of_rays*1.0e-6/times[1] << " Mrays/s (speedup "
+       << times[0]/times[1] << ")" << endl;
+}
+
+void RenderEngine::benchmark_spatial_splits()
+{
+  // Build a BVH with object splits only and one with spatial splits over
+  // the same scene and compare the throughput of eye ray packets. The
+  // selected acceleration data structure is built again afterwards.
+  const AcceleratorType types[2] = { acc_bvh, acc_sbvh };
+  double no_of_rays = static_cast<double>(res.x)*res.y;
+  double times[2];
+  int hits[2] = { 0, 0 };
+  AccStats stats[2];
+  for(unsigned int k = 0; k < 2; ++k)
+  {
+    scene.init_accelerator(types[k]);
+    stats[k] = scene.get_accelerator()->get_stats();
+
+    // Time a second pass, after the tree has been brought into the caches
+    trace_eye_rays(true, hits[k]);
+    times[k] = trace_eye_rays(true, hits[k]);
+  }
+  cout << "Eye rays: " << no_of_rays << ", hits: " << hits[0] << " object splits, " << hits[1] << " spatial splits" << endl
+       << "Object splits: " << no_of_rays*1.0e-6/times[0] << " Mrays/s, SAH cost " << stats[0].sah_cost << endl
+       << "Spatial splits: " << no_of_rays*1.0e-6/times[1] << " Mrays/s, SAH cost " << stats[1].sah_cost
+       << ", duplication factor " << stats[1].duplication() << endl
+       << "Speedup of spatial splits: " << times[0]/times[1] << " (SAH cost ratio "
+       << stats[0].sah_cost/stats[1].sah_cost << ")" << endl;
+  build_accelerator();
+}
+
+void RenderEngine::benchmark_random() const
+{
+  // Draw numbers from each generator on one thread and compare the
+  // throughput of drawing and of seeking to the numbers of a pixel sample
+  const unsigned int no_of_numbers = 1 << 25;
+  const unsigned int no_of_seeks = 1 << 20;
+  const RandomGenerator types[2] = { rng_mt19937, rng_pcg32 };
+  const char* names[2] = { "MT19937", "PCG32" };
+  for(unsigned int k = 0; k < 2; ++k)
+  {
+    Randomizer rng(seed, types[k]);
+    double sum = 0.0;
+    Timer timer;
+    timer.start();
+    for(unsigned int i = 0; i < no_of_numbers; ++i)
+      sum += rng.mt_random();
+    timer.stop();
+    double draw_time = timer.get_time();
+    timer.start();
+    for(unsigned int i = 0; i < no_of_seeks; ++i)
+    {
+      rng.seek(seed, i, 1);
+      sum += rng.mt_random();
+    }
+    timer.stop();
+    cout << names[k] << ": " << no_of_numbers*1.0e-9/draw_time << " samples per ns, "
+         << no_of_seeks*1.0e-6/timer.get_time() << " pixel seeks per us (mean "
+         << sum/(no_of_numbers + no_of_seeks) << ")" << endl;
+  }
+}
+
+void RenderEngine::scale_error_threshold(float scale)
+{
+  adaptive.set_threshold(adaptive.get_threshold()*scale);
+  cout << "Error threshold of adaptive sampling: " << adaptive.get_threshold() << endl;
+}
+
+void RenderEngine::next_pixel_sampler()
+{
+  current_sampler = (current_sampler + 1)%pixel_samplers.size();
+  const PixelSampler* sampler = pixel_samplers[current_sampler];
+  set_pixel_sampler(sampler);
+  clear_image();
+  cout << "Pixel sampler: " << (sampler ? sampler->describe() : "independent random numbers") << endl;
+}
+
 void RenderEngine::pathtrace()
 {
+  // Start over when the view changes and show a preview of the new view
+  // before adding samples
+  if(!cam.same_view(traced_cam))
+  {
+    traced_cam = cam;
+    clear_image();
+  }
+  if(preview_step > 0)
+  {
+    preview();
+    return;
+  }
+
   static Timer timer;
   static bool first = true;
   if(first)
@@ -331,26 +754,206 @@ void RenderEngine::pathtrace()
   bool print = (no_of_samples%10) == 0;
   if(print) cout << no_of_samples;
   timer.start(split_time);
-
-  #pragma omp parallel for private(randomizer)
-  for(int j = 0; j < static_cast<int>(res.y); ++j)
+  Timer pass_timer;
+  pass_timer.start();
+
+  // PCG32 can start every pixel sample at a position of its own, which
+  // makes the image independent of the tile size as well. With adaptive
+  // sampling, a pass only renders the tiles that have not converged, and
+  // the pixels of a tile are at the sample number of the tile.
+  bool seek_pixels = get_random_generator() == rng_pcg32;
+  const vector<unsigned int>& active = adaptive.get_active_tiles();
+  unsigned int dot_interval = std::max(static_cast<unsigned int>(active.size())/10, 1u);
+  scheduler.start(active);
+  #pragma omp parallel
   {
-    for(unsigned int i = 0; i < res.x; ++i)
-      tracer.update_pixel(i, j, sample_number, image[i + j*res.x]);
-    if(print && ((j + 1) % 50) == 0)
-      cerr << ".";
+    unsigned int t;
+    while(scheduler.next_tile(t))
+    {
+      Timer tile_timer;
+      tile_timer.start();
+      unsigned int tile_samples = adaptive.get_samples(t);
+      seed_thread_randomizer(seed, t, tile_samples + 1);
+      const RenderTile& tile = scheduler.get_tile(t);
+      for(unsigned int j = tile.y; j < tile.y + tile.h; ++j)
+        for(unsigned int i = tile.x; i < tile.x + tile.w; ++i)
+        {
+          unsigned int p = i + j*res.x;
+          if(seek_pixels)
+            seek_thread_randomizer(seed, p, tile_samples + 1);
+          adaptive.add_sample(p, tracer.compute_sample(i, j, tile_samples), image.at(i, j), tile_samples);
+        }
+      adaptive.finish_tile(t, tile, image);
+      tile_timer.stop();
+      if(scheduler.finish_tile(t, tile_timer.get_time()) % dot_interval == 0 && print)
+        cerr << ".";
+    }
+  }
+  // The list of active tiles changes when it is updated
+  for(unsigned int i = 0; i < active.size(); ++i)
+  {
+    const RenderTile& tile = scheduler.get_tile(active[i]);
+    image.mark_dirty(tile.x, tile.y, tile.w, tile.h);
   }
+  adaptive.update_active();
 
   timer.stop();
+  pass_timer.stop();
+  scheduler.stop(pass_timer.get_time());
   split_time = timer.get_time();
-  if(print) cout << ": " << split_time << endl;
+  if(print) cout << ": " << split_time << endl << scheduler.describe() << endl << adaptive.describe() << endl;
   ++sample_number;
 
+  // Stop by target error rather than by number of passes
+  if(adaptive.is_converged())
+  {
+    cout << "Converged after " << sample_number << " passes in " << split_time << " s. " << adaptive.describe() << endl;
+    tracing = false;
+    done = true;
+  }
+
+  if(headless())
+    return;
   init_texture();
   glutPostRedisplay();
 }
 
 
+int RenderEngine::render_batch(int argc, char** argv)
+{
+  headless() = true;
+  string view_file;
+  string png_name;
+  unsigned int shader_no = current_shader;
+  unsigned int spp = 0;
+  unsigned int frames = 1;
+  string benchmark;
+  float target_error = 0.0f;
+  unsigned int w = res.x;
+  unsigned int h = res.y;
+
+  // Arguments that are not options are scene files, which are passed on
+  // to load_files(...) as if given to the interactive mode
+  vector<char*> files(1, argv[0]);
+  for(int i = 1; i < argc; ++i)
+  {
+    string arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : 0;
+    bool valid = value != 0;
+    if(arg == "-v" && valid)
+      view_file = value;
+    else if(arg == "-s" && valid)
+      shader_no = atoi(value);
+    else if(arg == "-n" && valid)
+      spp = atoi(value);
+    else if(arg == "-e" && valid)
+    {
+      target_error = static_cast<float>(atof(value));
+      valid = target_error > 0.0f;
+    }
+    else if(arg == "-r" && valid)
+      valid = sscanf(value, "%ux%u", &w, &h) == 2 && w > 0 && h > 0;
+    else if(arg == "-o" && valid)
+      png_name = value;
+    else if(arg == "-t" && valid)
+    {
+      frames = atoi(value);
+      valid = frames > 0;
+    }
+    else if(arg == "-a" && valid)
+    {
+      const char** name = find(accelerator_names, accelerator_names + no_of_accelerators, string(value));
+      acc_type = static_cast<AcceleratorType>(name - accelerator_names);
+      valid = name != accelerator_names + no_of_accelerators;
+    }
+    else if(arg == "-b" && valid)
+    {
+      benchmark = value;
+      valid = benchmark == "packets" || benchmark == "random" || benchmark == "sbvh";
+    }
+    else if(arg.size() > 1 && arg[0] == '-')
+      valid = false;
+    else
+    {
+      files.push_back(argv[i]);
+      continue;
+    }
+    if(!valid)
+    {
+      cerr << "Error: Invalid argument " << arg << endl << batch_usage;
+      return 1;
+    }
+    ++i;
+  }
+  if(shader_no >= shaders.size())
+  {
+    cerr << "Error: There is no shader number " << shader_no << endl << batch_usage;
+    return 1;
+  }
+
+  set_resolution(w, h);
+  load_files(files.size(), &files[0]);
+  if(!view_file.empty())
+  {
+    if(!ifstream(view_file.c_str(), ifstream::binary))
+    {
+      cerr << "Error: Could not open view file " << view_file << endl;
+      return 1;
+    }
+    load_view(view_file);
+  }
+  set_current_shader(shader_no);
+  init_tracer();
+  if(benchmark == "packets")
+    benchmark_packets();
+  else if(benchmark == "random")
+    benchmark_random();
+  else if(benchmark == "sbvh")
+    benchmark_spatial_splits();
+  if(!benchmark.empty())
+    return 0;
+  if(png_name.empty())
+    png_name = default_png_name();
+  if(target_error > 0.0f)
+  {
+    adaptive.set_threshold(target_error);
+    if(!adaptive.is_enabled())
+      adaptive.toggle();
+  }
+
+  // The frames of a turntable turn the scene between them, which refits
+  // the acceleration structure instead of building it again
+  for(unsigned int frame = 0; frame < frames; ++frame)
+  {
+    if(frame > 0)
+      turn_scene(2.0f*M_PIf/frames);
+    if(spp == 0)
+      render();
+    else
+    {
+      tracing = true;
+      for(unsigned int i = 0; i < spp && tracing; ++i)
+        pathtrace();
+      tracing = false;
+      done = true;
+    }
+
+    image.apply(tone_map);
+    string frame_name = png_name;
+    if(frames > 1)
+    {
+      ostringstream number;
+      number << "_" << setfill('0') << setw(3) << frame;
+      size_t dot = frame_name.find_last_of('.');
+      frame_name.insert(dot == frame_name.npos ? frame_name.size() : dot, number.str());
+    }
+    if(!save_as_bitmap(frame_name))
+      return 1;
+  }
+  return 0;
+}
+
+
 //////////////////////////////////////////////////////////////////////
 // Export/import
 //////////////////////////////////////////////////////////////////////
@@ -384,6 +987,11 @@ void RenderEngine::load_view(const string& filename)
 }
 
 void RenderEngine::save_as_bitmap()
+{
+  save_as_bitmap(default_png_name());
+}
+
+string RenderEngine::default_png_name() const
 {
   string png_name = "out.png";
   if(!filename.empty())
@@ -392,19 +1000,30 @@ void RenderEngine::save_as_bitmap()
     split(filename, dot_split, ".");
     png_name = dot_split.front() + ".png";
   }
+  return png_name;
+}
+
+bool RenderEngine::save_as_bitmap(const string& png_name)
+{
   unsigned char* data = new unsigned char[res.x*res.y*3];
   for(unsigned int j = 0; j < res.y; ++j)
     for(unsigned int i = 0; i < res.x; ++i)
     {
       unsigned int d_idx = (i + res.x*j)*3;
-      unsigned int i_idx = i + res.x*(res.y - j - 1);
-      data[d_idx + 0] = static_cast<unsigned int>(std::min(image[i_idx].x, 1.0f)*255.0f + 0.5f);
-      data[d_idx + 1] = static_cast<unsigned int>(std::min(image[i_idx].y, 1.0f)*255.0f + 0.5f);
-      data[d_idx + 2] = static_cast<unsigned int>(std::min(image[i_idx].z, 1.0f)*255.0f + 0.5f);
+      const float3& pixel = image.at(i, res.y - j - 1);
+      data[d_idx + 0] = static_cast<unsigned int>(std::min(pixel.x, 1.0f)*255.0f + 0.5f);
+      data[d_idx + 1] = static_cast<unsigned int>(std::min(pixel.y, 1.0f)*255.0f + 0.5f);
+      data[d_idx + 2] = static_cast<unsigned int>(std::min(pixel.z, 1.0f)*255.0f + 0.5f);
     }
-  stbi_write_png(png_name.c_str(), res.x, res.y, 3, data, res.x*3);
+  int written = stbi_write_png(png_name.c_str(), res.x, res.y, 3, data, res.x*3);
   delete [] data;
+  if(!written)
+  {
+    cerr << "Error: Could not write " << png_name << "." << endl;
+    return false;
+  }
   cout << "Rendered image stored in " << png_name << "." << endl;
+  return true;
 }
 
 
@@ -606,6 +1225,76 @@ void RenderEngine::keyboard(unsigned char key, int x, int y)
       render_engine.render();
     glutPostRedisplay();
     break;
+  // Press 'P' to compare the speed of tracing eye rays one by one
+  // and as packets.
+  case 'P':
+    render_engine.benchmark_packets();
+    break;
+  // Press 'B' to compare the speed of BVHs built with object splits only
+  // and with spatial splits.
+  case 'B':
+    render_engine.benchmark_spatial_splits();
+    break;
+  // Press 'R' to compare the speed of the random number generators.
+  case 'R':
+    render_engine.benchmark_random();
+    break;
+  // Press 'G' to switch between the MT19937 and PCG32 random number
+  // generators used for rendering (PCG32 is the default).
+  case 'G':
+    {
+      bool pcg = get_random_generator() == rng_mt19937;
+      set_random_generator(pcg ? rng_pcg32 : rng_mt19937);
+      render_engine.clear_image();
+      cout << "Random number generator: " << (pcg ? "PCG32" : "MT19937") << endl;
+    }
+    break;
+  // Press 'a' to switch to the next acceleration data structure (brute
+  // force, BSP tree, BVH, QBVH, BVH with spatial splits, compressed BVH).
+  case 'a':
+    render_engine.next_accelerator();
+    glutPostRedisplay();
+    break;
+  // Press 'M' to switch to the next pixel sampler used for rendering.
+  case 'M':
+    render_engine.next_pixel_sampler();
+    break;
+  // Press 'A' to toggle adaptive sampling, which stops rendering a tile
+  // when its error estimate is below the threshold and stops the path
+  // tracer when all tiles have converged. Use '<' and '>' to halve or
+  // double the threshold.
+  case 'A':
+    {
+      bool adaptive_on = render_engine.toggle_adaptive_sampling();
+      cout << "Toggled adaptive sampling " << (adaptive_on ? "on" : "off") << endl;
+    }
+    break;
+  case '<':
+    render_engine.scale_error_threshold(0.5f);
+    break;
+  case '>':
+    render_engine.scale_error_threshold(2.0f);
+    break;
+  // Press '[' or ']' to halve or double the render resolution and 'W'
+  // to render at the resolution of the window.
+  case '[':
+    render_engine.scale_resolution(0.5f);
+    glutPostRedisplay();
+    break;
+  case ']':
+    render_engine.scale_resolution(2.0f);
+    glutPostRedisplay();
+    break;
+  case 'W':
+    render_engine.fit_resolution_to_window();
+    glutPostRedisplay();
+    break;
+  // Press 'T' to turn the scene 10 degrees about the vertical axis, as
+  // on a turntable. This refits the acceleration structure.
+  case 'T':
+    render_engine.turn_scene(M_PIf/18.0f);
+    glutPostRedisplay();
+    break;
   // Press 's' to toggle shadows on/off
   case 's':
     {
@@ -28,6 +28,10 @@
 #include "MerlShader.h"
 #include "PanoramicTexture.h"
 #include "Gamma.h"
+#include "TileScheduler.h"
+#include "PixelSampler.h"
+#include "AdaptiveSampler.h"
+#include "TiledImage.h"
 
 class RenderEngine
 {
@@ -36,11 +40,25 @@ public:
   RenderEngine();
   ~RenderEngine();
   void load_files(int argc, char** argv);
+
+  // Adds an instance for every line of a text file of the form
+  //   <obj file> <x> <y> <z> [<rotation about y in radians> [<scale>]]
+  // Instances of the same file share its geometry and bottom-level BVH.
+  // Relative paths start from the directory of the instance file, and
+  // lines starting with # are comments.
+  void load_instances(const std::string& inst_file);
   void init_GLUT(int argc, char** argv);
   void init_GL();
   void init_view();
   void init_tracer();
   void init_texture();
+  void set_resolution(unsigned int w, unsigned int h);
+  void scale_resolution(float scale);
+  void fit_resolution_to_window() { set_resolution(win.x, win.y); }
+
+  // Renders the scene given on the command line to an image file without
+  // opening a window or making any OpenGL calls and returns the exit code
+  int render_batch(int argc, char** argv);
 
   // Rendering
   unsigned int no_of_shaders() const { return shaders.size(); }
@@ -51,18 +69,29 @@ public:
   void increment_pixel_subdivs() { tracer.increment_pixel_subdivs(); }
   void decrement_pixel_subdivs() { tracer.decrement_pixel_subdivs(); }
   bool toggle_pathtracing() { return tracing = !tracing; }
+  bool toggle_adaptive_sampling() { return adaptive.toggle(); }
+  void scale_error_threshold(float scale);
   void clear_image();
   void apply_tone_map();
   void unapply_tone_map();
   void add_textures();
   void readjust_camera();
   void render();
+  void benchmark_packets();
+  void benchmark_random() const;
+  void benchmark_spatial_splits();
+  void next_accelerator();
+  void next_pixel_sampler();
   void pathtrace();
+  void preview();
+  void turn_scene(float angle);
 
   // Export/import
   void save_view(const std::string& filename) const;
   void load_view(const std::string& filename);
   void save_as_bitmap();
+  bool save_as_bitmap(const std::string& png_name);
+  std::string default_png_name() const;
 
   // Draw functions
   void set_gl_ortho_proj() const;
@@ -99,24 +128,34 @@ public:
   int get_spin_timer() const { return spin_timer; }
 
 private:
+  void build_accelerator();
+  double trace_eye_rays(bool packets, int& no_of_hits);
+
   // Window and render resolution
   optix::uint2 win;
   optix::uint2 res;
 
   // Render data
-  std::vector<optix::float3> image;
+  TiledImage image;
   unsigned int image_tex;
+  optix::uint2 tex_res;
   float sample_number;
   double split_time;
 
+  // Grid spacing of the next progressive preview pass (zero when done)
+  unsigned int preview_step;
+
   // View control
   int mouse_state;
   int spin_timer;
   GLViewController* vctrl;
   Camera cam;
+  Camera traced_cam;
+  optix::float3 turntable_center;
 
   // Geometry container
   Scene scene;
+  AcceleratorType acc_type;
   
   // Output file name
   std::string filename;
@@ -127,6 +166,16 @@ private:
   unsigned int caustics_particles;
   bool tracing;
   bool done;
+  TileScheduler scheduler;
+  AdaptiveSampler adaptive;
+  unsigned int seed;
+
+  // Samples of the pixels (none means independent random numbers)
+  SobolSampler sobol_sampler;
+  HaltonSampler halton_sampler;
+  BlueNoiseSampler blue_noise_sampler;
+  std::vector<const PixelSampler*> pixel_samplers;
+  unsigned int current_sampler;
 
   // Light
   optix::float3 light_pow;
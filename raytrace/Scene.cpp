@@ -31,12 +31,24 @@
 using namespace std;
 using namespace optix;
 
+namespace
+{
+  // Face corner of vertices that no face refers to
+  const unsigned int no_corner = ~0u;
+}
+
 Scene::~Scene()
 {
+  delete acc;
   for(unsigned int i = 0; i < objects.size(); ++i)
     delete objects[i];
   for(unsigned int i = 0; i < planes.size(); ++i)
     delete planes[i];
+  for(map<string, InstancedMesh>::iterator i = instanced_meshes.begin(); i != instanced_meshes.end(); ++i)
+  {
+    delete i->second.acc;
+    delete i->second.mesh;
+  }
   for(unsigned int i = 0; i < light_meshes.size(); ++i)
     delete light_meshes[i];
   for(unsigned int i = 0; i < extracted_lights.size(); ++i)
@@ -66,13 +78,41 @@ void Scene::load_mesh(const string& filename, const Matrix4x4& transform)
   cout << "No. of triangles: " << mesh->geometry.no_faces() << endl;
   meshes.push_back(mesh);
   objects.push_back(mesh);
-  transforms.push_back(Matrix4x4::identity());
 
   // Correct scene bounding box
   Aabb mesh_bbox = mesh->compute_bbox();
   bbox.include(mesh_bbox);
 }
 
+void Scene::add_instance(const string& filename, const Matrix4x4& transform, const Matrix4x4& mesh_transform)
+{
+  // The first instance of a file loads the mesh, applies the mesh transform,
+  // and builds the bottom-level BVH shared by all instances of the file
+  InstancedMesh& instanced = instanced_meshes[filename];
+  if(!instanced.mesh)
+  {
+    cout << "Loading " << filename << " for instancing" << endl;
+    TriMesh* mesh = new TriMesh;
+    obj_load(filename, *mesh);
+    if(!mesh->has_normals())
+    {
+      cout << "Computing normals" << endl;
+      mesh->compute_normals();
+    }
+    mesh->transform(mesh_transform);
+    mesh->compute_areas();
+    cout << "No. of triangles: " << mesh->geometry.no_faces() << endl;
+    instanced.mesh = mesh;
+    instanced.acc = new BvhTree;
+    instanced.acc->init(vector<Object3D*>(1, mesh), vector<const Plane*>());
+  }
+
+  Instance* instance = new Instance(instanced, transform);
+  instances.push_back(instance);
+  objects.push_back(instance);
+  bbox.include(instance->compute_bbox());
+}
+
 void Scene::load_texture(const ObjMaterial& mat, bool is_sphere)
 {
   if(mat.has_texture && textures.find(mat.tex_name) == textures.end())
@@ -101,6 +141,9 @@ void Scene::load_textures()
   for(unsigned int i = 0; i < meshes.size(); ++i)
     for(unsigned int j = 0; j < meshes[i]->materials.size(); ++j)
       load_texture(meshes[i]->materials[j]);
+  for(map<string, InstancedMesh>::iterator i = instanced_meshes.begin(); i != instanced_meshes.end(); ++i)
+    for(unsigned int j = 0; j < i->second.mesh->materials.size(); ++j)
+      load_texture(i->second.mesh->materials[j]);
   for(unsigned int i = 0; i < planes.size(); ++i)
     load_texture(planes[i]->get_material());
   for(unsigned int i = 0; i < spheres.size(); ++i)
@@ -211,6 +254,7 @@ unsigned int Scene::extract_area_lights(RayTracer *tracer, unsigned int samples_
       lights.push_back(new AreaLight(tracer, mesh, samples_per_light));
     }
   }
+  redo_shading();
   return lights.size();
 }
 
@@ -218,6 +262,7 @@ void Scene::toggle_shadows()
 {
   for(unsigned int i = 0; i < lights.size(); ++i)
     lights[i]->toggle_shadows();
+  redo_shading();
 }
 
 void Scene::set_shader(int model, Shader* s)
@@ -252,6 +297,31 @@ void Scene::draw()
   if(redraw)
   {
     cout << "Generating scene display list";
+
+    // Shade again the vertices of illumination models whose shader changed
+    vector<char> redo_models(shaders.size(), 0);
+    bool redo = false;
+    for(unsigned int i = 0; i < shaders.size(); ++i)
+      if(i >= shaded_with.size() || shaders[i] != shaded_with[i])
+      {
+        redo_models[i] = 1;
+        redo = true;
+      }
+    if(redo)
+      for(map<const Object3D*, VertexShades>::iterator i = vertex_shades.begin(); i != vertex_shades.end(); ++i)
+      {
+        VertexShades& shades = i->second;
+        const TriMesh* mesh = shades.mesh;
+        for(unsigned int v = 0; v < shades.valid.size(); ++v)
+          if(shades.corners[v] != no_corner)
+          {
+            unsigned int model = mesh->materials[mesh->mat_idx[shades.corners[v]/3]].illum;
+            if(model < redo_models.size() && redo_models[model])
+              shades.valid[v] = 0;
+          }
+      }
+    shaded_with.assign(shaders.begin(), shaders.end());
+
     if(glIsList(disp_list))
       glDeleteLists(disp_list, 1);
     disp_list = glGenLists(1);
@@ -259,6 +329,14 @@ void Scene::draw()
 
     for(unsigned int i = 0; i < meshes.size(); ++i)
       draw_mesh(meshes[i]);
+    for(unsigned int i = 0; i < instances.size(); ++i)
+    {
+      // OpenGL expects column-major matrices
+      glPushMatrix();
+      glMultMatrixf(instances[i]->get_transform().transpose().getData());
+      draw_mesh(instances[i]->get_mesh(), instances[i]);
+      glPopMatrix();
+    }
     for(unsigned int i = 0; i < planes.size(); ++i)
       draw_plane(planes[i]);
     for(unsigned int i = 0; i < spheres.size(); ++i)
@@ -273,9 +351,60 @@ void Scene::draw()
   glCallList(disp_list);
 }
 
-void Scene::init_accelerator()
+void Scene::init_accelerator(AcceleratorType type, const string& cache_file)
+{
+  delete acc;
+  switch(type)
+  {
+  case acc_brute_force:
+    acc = new Accelerator;
+    break;
+  case acc_bsp_tree:
+    acc = new BspTree;
+    break;
+  case acc_qbvh:
+    acc = new QBvhTree;
+    break;
+  case acc_sbvh:
+    {
+      BvhTree* bvh = new BvhTree;
+      bvh->set_spatial_splits(0.3f);
+      acc = bvh;
+    }
+    break;
+  case acc_compressed_bvh:
+    acc = new CompressedBvhTree;
+    break;
+  default:
+    acc = new BvhTree;
+  }
+  acc->set_cache_file(cache_file);
+  acc->init(objects, planes);
+}
+
+void Scene::update_accelerator()
+{
+  // Refit the accelerators after objects or instanced meshes have been
+  // transformed, which is much faster than building them anew
+  for(map<string, InstancedMesh>::iterator i = instanced_meshes.begin(); i != instanced_meshes.end(); ++i)
+    i->second.acc->refit();
+  if(acc)
+    acc->refit();
+
+  bbox.invalidate();
+  for(unsigned int i = 0; i < objects.size(); ++i)
+    bbox.include(objects[i]->compute_bbox());
+}
+
+void Scene::turn(const float3& center, float angle)
 {
-  acc.init(objects, planes);
+  Matrix4x4 m = Matrix4x4::translate(center)*Matrix4x4::rotate(angle, make_float3(0.0f, 1.0f, 0.0f))*Matrix4x4::translate(-center);
+  for(unsigned int i = 0; i < objects.size(); ++i)
+    objects[i]->transform(m);
+  for(unsigned int i = 0; i < light_meshes.size(); ++i)
+    light_meshes[i]->transform(m);
+  update_accelerator();
+  redo_shading();
 }
 
 bool Scene::is_specular(const ObjMaterial* m) const
@@ -283,17 +412,49 @@ bool Scene::is_specular(const ObjMaterial* m) const
   return m && ((m->illum > 1 && m->illum < 10) || m->illum > 10);
 }
 
-void Scene::draw_mesh(const TriMesh* mesh) const
+void Scene::redo_shading(const ObjMaterial* m)
+{
+  for(map<const Object3D*, VertexShades>::iterator i = vertex_shades.begin(); i != vertex_shades.end(); ++i)
+  {
+    VertexShades& shades = i->second;
+    const TriMesh* mesh = shades.mesh;
+    for(unsigned int v = 0; v < shades.valid.size(); ++v)
+      if(!m || (shades.corners[v] != no_corner && &mesh->materials[mesh->mat_idx[shades.corners[v]/3]] == m))
+        shades.valid[v] = 0;
+  }
+  redraw = true;
+}
+
+void Scene::draw_mesh(const TriMesh* mesh, const Instance* instance)
 {
   const IndexedFaceSet& geometry = mesh->geometry;
   const IndexedFaceSet& normals = mesh->normals;
-  vector<float3*> shades(geometry.no_vertices(), static_cast<float3*>(0));
   const int faces = geometry.no_faces();
   const unsigned int indices = faces*3;
+
+  // The first time a mesh or an instance is drawn, find a face corner
+  // for each vertex
+  VertexShades& shades = vertex_shades[instance ? static_cast<const Object3D*>(instance) : mesh];
+  if(shades.colors.size() != geometry.no_vertices())
+  {
+    shades.mesh = mesh;
+    shades.instance = instance;
+    shades.colors.assign(geometry.no_vertices(), make_float3(0.5f));
+    shades.corners.assign(geometry.no_vertices(), no_corner);
+    shades.valid.assign(geometry.no_vertices(), 0);
+    for(unsigned int i = 0; i < indices; ++i)
+    {
+      unsigned int v = (&geometry.face(i/3).x)[i%3];
+      if(shades.corners[v] == no_corner)
+        shades.corners[v] = i;
+    }
+  }
+  shade_vertices(shades);
+
   vector<float3> verts(indices);
   vector<float3> norms(indices);
   vector<float3> colors(indices);
-  #pragma omp parallel for private(randomizer)
+  #pragma omp parallel for
   for(int i = 0; i < faces; ++i)
   {
     const unsigned int* g_face = &geometry.face(i).x;
@@ -303,36 +464,8 @@ void Scene::draw_mesh(const TriMesh* mesh) const
       unsigned int idx = i*3 + j;
       verts[idx] = geometry.vertex(g_face[j]);
       norms[idx] = normalize(normals.vertex(n_face[j]));
-      colors[idx] = make_float3(0.5f);
-
-      if(!shades[g_face[j]])
-      {
-        const ObjMaterial* m = &mesh->materials[mesh->mat_idx[i]];
-        unsigned int model = m->illum;
-        if(model < shaders.size() && shaders[model])
-        {
-          float3 ray_vec = verts[idx] - cam->get_position();
-          Ray r(cam->get_position(), normalize(ray_vec), 0, 0.0f);
-          HitInfo hit;
-          hit.has_hit = true;
-          hit.dist = length(ray_vec);
-          hit.position = verts[idx];
-          hit.geometric_normal = hit.shading_normal = norms[idx];
-          hit.material = m;
-          hit.texcoord = make_float3(0.0f);
-          colors[idx] = shaders[model]->shade(r, hit);
-        }
-        if(!shades[g_face[j]])
-        #pragma omp critical (store_shade)
-        {
-          shades[g_face[j]] = new float3(colors[idx]);
-        }
-      }
-      else
-        colors[idx] = *shades[g_face[j]];
+      colors[idx] = shades.colors[g_face[j]];
     }
-    if(faces > 100 && (i + 1) % (faces/10) == 0)
-      cout << ".";
   }
 
   glEnableClientState(GL_VERTEX_ARRAY);
@@ -348,9 +481,54 @@ void Scene::draw_mesh(const TriMesh* mesh) const
   glDisableClientState(GL_COLOR_ARRAY);
   glDisableClientState(GL_NORMAL_ARRAY);
   glDisableClientState(GL_VERTEX_ARRAY);
+}
 
-  for(unsigned int i = 0; i < shades.size(); ++i)
-    delete shades[i];
+void Scene::shade_vertices(VertexShades& shades) const
+{
+  const TriMesh* mesh = shades.mesh;
+  const Instance* instance = shades.instance;
+  const IndexedFaceSet& geometry = mesh->geometry;
+  const IndexedFaceSet& normals = mesh->normals;
+
+  // List the vertices to shade, so the threads share only those
+  vector<unsigned int> redo;
+  for(unsigned int v = 0; v < shades.valid.size(); ++v)
+    if(!shades.valid[v] && shades.corners[v] != no_corner)
+      redo.push_back(v);
+  const int n = redo.size();
+  #pragma omp parallel for schedule(dynamic, 64)
+  for(int i = 0; i < n; ++i)
+  {
+    unsigned int v = redo[i];
+    unsigned int face = shades.corners[v]/3;
+    const ObjMaterial* m = &mesh->materials[mesh->mat_idx[face]];
+    unsigned int model = m->illum;
+    float3 color = make_float3(0.5f);
+    if(model < shaders.size() && shaders[model])
+    {
+      float3 vertex = geometry.vertex(v);
+      float3 normal = normals.vertex((&normals.face(face).x)[shades.corners[v]%3]);
+      if(instance)
+      {
+        vertex = make_float3(instance->get_transform()*make_float4(vertex, 1.0f));
+        normal = make_float3(instance->get_normal_transform()*make_float4(normal, 0.0f));
+      }
+      float3 ray_vec = vertex - cam->get_position();
+      Ray r(cam->get_position(), normalize(ray_vec), 0, 0.0f);
+      HitInfo hit;
+      hit.has_hit = true;
+      hit.dist = length(ray_vec);
+      hit.position = vertex;
+      hit.geometric_normal = hit.shading_normal = normalize(normal);
+      hit.material = m;
+      hit.texcoord = make_float3(0.0f);
+      color = shaders[model]->shade(r, hit);
+    }
+    shades.colors[v] = color;
+    shades.valid[v] = 1;
+    if(n > 100 && (i + 1) % (n/10) == 0)
+      cout << ".";
+  }
 }
 
 void Scene::draw_plane(const Plane* plane)
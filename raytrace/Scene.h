@@ -18,23 +18,47 @@
 #include "Camera.h"
 #include "Shader.h"
 #include "HitInfo.h"
+#include "Accelerator.h"
+#include "AccStats.h"
 #include "BspTree.h"
+#include "BvhTree.h"
+#include "QBvhTree.h"
+#include "CompressedBvhTree.h"
+#include "Instance.h"
 #include "Texture.h"
 #include "MerlTexture.h"
 
 class Light;
 class RayTracer;
 
+// Radiance at the vertices of a mesh as drawn in the OpenGL preview. Each
+// vertex is shaded with the normal and material of the first face corner
+// that refers to it, and only invalid vertices are shaded again. Every
+// instance of a shared mesh has shades of its own, found in world space.
+struct VertexShades
+{
+  VertexShades() : mesh(0), instance(0) { }
+
+  const TriMesh* mesh;
+  const Instance* instance;
+  std::vector<optix::float3> colors;
+  std::vector<unsigned int> corners;
+  std::vector<char> valid;
+};
+
+enum AcceleratorType { acc_brute_force, acc_bsp_tree, acc_bvh, acc_qbvh, acc_sbvh, acc_compressed_bvh };
+
 class Scene
 {
 public:
-  Scene(Camera* c) : cam(c), shaders(10, static_cast<Shader*>(0)), redraw(true), do_textures(false) { }
+  Scene(Camera* c) : acc(0), cam(c), shaders(10, static_cast<Shader*>(0)), redraw(true), do_textures(false) { }
   ~Scene();
 
   // Accessors
   void set_shader(int model, Shader* s);
   const std::vector<Light*>& get_lights() const { return lights; }
   const std::vector<const TriMesh*>& get_meshes() const { return meshes; }
+  std::vector<Object3D*>& get_objects() { return objects; }
   const Shader* get_shader(const HitInfo& hit) const;
   Camera* get_camera() { return cam; }
   void get_bsphere(optix::float3& c, float& r) const;
@@ -43,6 +67,8 @@ public:
 
   // Loaders
   void load_mesh(const std::string& filename, const optix::Matrix4x4& transform = optix::Matrix4x4::identity());
+  void add_instance(const std::string& filename, const optix::Matrix4x4& transform,
+                    const optix::Matrix4x4& mesh_transform = optix::Matrix4x4::identity());
   void load_texture(const ObjMaterial& mat, bool is_sphere = false);
   void load_textures();
   void add_plane(const optix::float3& position, const optix::float3& normal, const std::string& mtl_file, unsigned int idx = 0, float tex_scale = 1.0f);
@@ -50,26 +76,60 @@ public:
   void add_triangle(const optix::float3& v0, const optix::float3& v1, const optix::float3& v2, const std::string& mtl_file, unsigned int idx = 0);
 
   // Light handling
-  void add_light(Light* light) { if(light) lights.push_back(light); }
+  void add_light(Light* light) { if(light) { lights.push_back(light); redo_shading(); } }
   unsigned int extract_area_lights(RayTracer* tracer, unsigned int samples_per_light = 1);
   void toggle_shadows();
 
   // Draw
   void draw();
-  void textures_on() { do_textures = true; redraw = true; }
+  void textures_on() { do_textures = true; redo_shading(); }
   void redo_display_list() { redraw = true; }
+
+  // Marks the cached vertex radiance of the preview as outdated for all
+  // vertices or for those with a given material. Changing the shader of an
+  // illumination model, the lights, or the textures does this automatically.
+  // Call it after changing the state of a shader, such as its photon map.
+  void redo_shading(const ObjMaterial* m = 0);
   bool is_redoing_display_list() { return redraw; }
 
   // Ray intersection
-  void init_accelerator();
-  bool closest_hit(optix::Ray& r, HitInfo& hit) const { return acc.closest_hit(r, hit); }
-  bool any_hit(optix::Ray& r, HitInfo& hit) const { return acc.any_hit(r, hit); }
+  void init_accelerator(AcceleratorType type = acc_bvh, const std::string& cache_file = "");
+  void update_accelerator();
+
+  // Rotates the objects and the area lights extracted from them about the
+  // vertical axis through a point and refits the acceleration structure
+  void turn(const optix::float3& center, float angle);
+  const Accelerator* get_accelerator() const { return acc; }
+  bool closest_hit(optix::Ray& r, HitInfo& hit) const
+  {
+    bool found = acc->closest_hit(r, hit);
+    RT_COUNT(rays, 1);
+    RT_COUNT(hits, found);
+    return found;
+  }
+  bool any_hit(optix::Ray& r, HitInfo& hit) const
+  {
+    bool found = acc->any_hit(r, hit);
+    RT_COUNT(rays, 1);
+    RT_COUNT(hits, found);
+    return found;
+  }
+  void closest_hit_packet(optix::Ray* rays, HitInfo* hits, unsigned int n) const
+  {
+    acc->closest_hit_packet(rays, hits, n);
+#ifdef RT_TRAVERSAL_STATS
+    RT_COUNT(rays, n);
+    for(unsigned int i = 0; i < n; ++i)
+      RT_COUNT(hits, hits[i].has_hit);
+#endif
+  }
 
   // Material classification
   bool is_specular(const ObjMaterial* m) const;
 
 private:
-  void draw_mesh(const TriMesh* mesh) const;
+  void draw_mesh(const TriMesh* mesh, const Instance* instance = 0);
+  void shade_vertices(VertexShades& shades) const;
   void draw_plane(const Plane* plane);
   void draw_sphere(const Sphere* sphere) const;
   void draw_triangle(const Triangle* triangle) const;
@@ -77,18 +137,21 @@ private:
   std::map<std::string, Texture*> textures;
   std::map<std::string, MerlTexture*> brdfs;
   std::vector<Light*> lights;
-  std::vector<const TriMesh*> light_meshes;
+  std::vector<TriMesh*> light_meshes;
   std::vector<unsigned int> extracted_lights;
   std::vector<const TriMesh*> meshes;
   std::vector<const Plane*> planes;
   std::vector<const Sphere*> spheres;
   std::vector<const Triangle*> triangles;
+  std::vector<const Instance*> instances;
+  std::map<std::string, InstancedMesh> instanced_meshes;
   std::vector<Object3D*> objects;
-  std::vector<optix::Matrix4x4> transforms;
-  BspTree acc;
+  Accelerator* acc;
   optix::Aabb bbox;
   Camera* cam;
   std::vector<Shader*> shaders;
+  std::vector<const Shader*> shaded_with;
+  std::map<const Object3D*, VertexShades> vertex_shades;
   bool redraw;
   bool do_textures;
 };
@@ -68,6 +68,21 @@ bool Sphere::intersect(const Ray& r, HitInfo& hit, unsigned int prim_idx) const
   return true;
 }
 
+bool Sphere::intersect_any(const Ray& r, unsigned int prim_idx) const
+{
+  float3 org_center = r.origin - center;
+  float bhalf = dot(org_center, r.direction);
+  float c = dot(org_center, org_center) - radius*radius;
+  float d = bhalf*bhalf - c;
+  if(d < 0.0f)
+    return false;
+
+  float discriminant = sqrt(d);
+  float t1 = -bhalf - discriminant;
+  float t2 = -bhalf + discriminant;
+  return (t1 <= r.tmax && t1 >= r.tmin) || (t2 <= r.tmax && t2 >= r.tmin);
+}
+
 void Sphere::transform(const Matrix4x4& m)
 {
   float3 radius_vec = make_float3(radius, 0.0f, 0.0f) + center;
@@ -25,7 +25,8 @@ void Texture::load(const char* filename)
   fdata = new float4[img_size];
   for(int i = 0; i < img_size; ++i)
     fdata[i] = look_up(i);
-  tex_handle = SOIL_create_OGL_texture(data, width, height, channels, tex_handle, SOIL_FLAG_INVERT_Y | SOIL_FLAG_TEXTURE_REPEATS);
+  if(!headless())
+    tex_handle = SOIL_create_OGL_texture(data, width, height, channels, tex_handle, SOIL_FLAG_INVERT_Y | SOIL_FLAG_TEXTURE_REPEATS);
   tex_target = GL_TEXTURE_2D;
 }
 
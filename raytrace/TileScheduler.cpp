@@ -0,0 +1,186 @@
+// 02562 Rendering Framework
+// Distributes the tiles of an image to the render threads, which steal
+// tiles from each other when they run out of their own.
+// Copyright (c) DTU Informatics 2011
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include "TileScheduler.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+  // Interleaves the bits of the tile coordinates
+  unsigned int morton_code(unsigned int x, unsigned int y)
+  {
+    unsigned int code = 0;
+    for(unsigned int i = 0; i < 16; ++i)
+      code |= ((x >> i) & 1) << 2*i | ((y >> i) & 1) << (2*i + 1);
+    return code;
+  }
+
+  struct MortonLess
+  {
+    MortonLess(unsigned int size) : tile_size(size) { }
+
+    bool operator()(const RenderTile& a, const RenderTile& b) const
+    {
+      return morton_code(a.x/tile_size, a.y/tile_size) < morton_code(b.x/tile_size, b.y/tile_size);
+    }
+
+    unsigned int tile_size;
+  };
+
+  unsigned int thread_number()
+  {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+  }
+
+  unsigned int max_threads()
+  {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+  }
+}
+
+void TileScheduler::init(unsigned int w, unsigned int h)
+{
+  width = w;
+  height = h;
+  tiles.clear();
+  for(unsigned int y = 0; y < height; y += tile_size)
+    for(unsigned int x = 0; x < width; x += tile_size)
+    {
+      RenderTile tile;
+      tile.x = x;
+      tile.y = y;
+      tile.w = std::min(tile_size, width - x);
+      tile.h = std::min(tile_size, height - y);
+      tiles.push_back(tile);
+    }
+  sort(tiles.begin(), tiles.end(), MortonLess(tile_size));
+}
+
+void TileScheduler::start()
+{
+  vector<unsigned int> all(tiles.size());
+  for(unsigned int i = 0; i < all.size(); ++i)
+    all[i] = i;
+  start(all);
+}
+
+void TileScheduler::start(const vector<unsigned int>& subset)
+{
+  queue = subset;
+  unsigned int no_of_threads = max_threads();
+  unsigned int no_of_tiles = queue.size();
+  deques.resize(no_of_threads);
+  for(unsigned int i = 0; i < no_of_threads; ++i)
+  {
+    deques[i].begin = i*no_of_tiles/no_of_threads;
+    deques[i].end = (i + 1)*no_of_tiles/no_of_threads;
+  }
+  tile_times.assign(tiles.size(), 0.0);
+  thread_times.assign(no_of_threads, 0.0);
+  finished = 0;
+  steals = 0;
+  wall_time = 0.0;
+}
+
+bool TileScheduler::next_tile(unsigned int& tile)
+{
+  unsigned int thread = thread_number();
+  bool found = false;
+  #pragma omp critical (tile_scheduler)
+  {
+    TileDeque& own = deques[thread];
+    if(own.begin < own.end)
+    {
+      tile = queue[own.begin++];
+      found = true;
+    }
+    else
+      found = steal(thread, tile);
+  }
+  return found;
+}
+
+unsigned int TileScheduler::finish_tile(unsigned int tile, double seconds)
+{
+  unsigned int thread = thread_number();
+  unsigned int done;
+  #pragma omp critical (tile_scheduler)
+  {
+    tile_times[tile] = seconds;
+    thread_times[thread] += seconds;
+    done = ++finished;
+  }
+  return done;
+}
+
+bool TileScheduler::steal(unsigned int thief, unsigned int& tile)
+{
+  // Take the back half of the fullest deque, which leaves the victim
+  // the tiles it is about to render
+  unsigned int victim = thief;
+  unsigned int most = 0;
+  for(unsigned int i = 0; i < deques.size(); ++i)
+  {
+    unsigned int left = deques[i].end - deques[i].begin;
+    if(left > most)
+    {
+      most = left;
+      victim = i;
+    }
+  }
+  if(most == 0)
+    return false;
+
+  TileDeque& from = deques[victim];
+  TileDeque& own = deques[thief];
+  unsigned int middle = from.end - (most + 1)/2;
+  own.begin = middle;
+  own.end = from.end;
+  from.end = middle;
+  tile = queue[own.begin++];
+  ++steals;
+  return true;
+}
+
+string TileScheduler::describe() const
+{
+  double total = 0.0;
+  unsigned int slowest = 0;
+  for(unsigned int i = 0; i < tile_times.size(); ++i)
+  {
+    total += tile_times[i];
+    if(tile_times[i] > tile_times[slowest])
+      slowest = i;
+  }
+  ostringstream ostr;
+  ostr << queue.size() << " tiles of " << tile_size << "x" << tile_size << " pixels";
+  if(queue.size() > 0)
+  {
+    const RenderTile& t = tiles[slowest];
+    ostr << ", " << total/queue.size()*1.0e3 << " ms per tile (slowest " << tile_times[slowest]*1.0e3
+         << " ms at " << t.x << "," << t.y << "), " << steals << " steals";
+  }
+  if(wall_time > 0.0 && thread_times.size() > 0)
+    ostr << ", thread utilization " << 100.0*total/(thread_times.size()*wall_time) << "%";
+  ostr << ".";
+  return ostr.str();
+}
@@ -0,0 +1,95 @@
+// 02562 Rendering Framework
+// Distributes the tiles of an image to the render threads, which steal
+// tiles from each other when they run out of their own.
+// Copyright (c) DTU Informatics 2011
+
+#ifndef TILESCHEDULER_H
+#define TILESCHEDULER_H
+
+#include <vector>
+#include <string>
+
+struct RenderTile
+{
+  unsigned int x, y;  // lower left pixel
+  unsigned int w, h;
+};
+
+// Range of the tiles of a pass owned by a thread. The owner takes
+// tiles from the front and other threads steal from the back.
+struct TileDeque
+{
+  unsigned int begin;
+  unsigned int end;
+};
+
+// The tiles are ordered along a Morton curve, so the tiles of a thread
+// lie close together in the image, and every thread starts with an equal
+// share of them. A thread whose share is done steals half of the tiles
+// left to another thread. Taking a tile costs far less than rendering it,
+// so the deques share one critical section. Use from the threads of a
+// parallel region:
+//
+//   scheduler.start();
+//   Timer timer; timer.start();
+//   #pragma omp parallel
+//   {
+//     unsigned int t;
+//     while(scheduler.next_tile(t))
+//     {
+//       ... render scheduler.get_tile(t) ...
+//       scheduler.finish_tile(t, seconds);
+//     }
+//   }
+//   timer.stop(); scheduler.stop(timer.get_time());
+class TileScheduler
+{
+public:
+  TileScheduler(unsigned int tile_side = 16)
+    : tile_size(tile_side), width(0), height(0), finished(0), steals(0), wall_time(0.0)
+  { }
+
+  void init(unsigned int w, unsigned int h);
+
+  // Deals the tiles to as many deques as there can be threads in a
+  // parallel region and clears the timings
+  void start();
+
+  // Deals only the listed tiles, which must be in render order
+  void start(const std::vector<unsigned int>& subset);
+
+  // Takes the next tile of the calling thread, stealing if its own deque
+  // is empty. Returns false once there are no tiles left anywhere.
+  bool next_tile(unsigned int& tile);
+
+  // Records the render time of a tile and returns the number of tiles
+  // finished so far
+  unsigned int finish_tile(unsigned int tile, double seconds);
+
+  // Ends the pass with its wall clock time, which is the reference of
+  // the thread utilization in describe()
+  void stop(double seconds) { wall_time = seconds; }
+
+  unsigned int get_no_of_tiles() const { return tiles.size(); }
+  const RenderTile& get_tile(unsigned int tile) const { return tiles[tile]; }
+  const std::vector<double>& get_tile_times() const { return tile_times; }
+  unsigned int get_tile_size() const { return tile_size; }
+  std::string describe() const;
+
+private:
+  bool steal(unsigned int thief, unsigned int& tile);
+
+  unsigned int tile_size;
+  unsigned int width;
+  unsigned int height;
+  std::vector<RenderTile> tiles;
+  std::vector<unsigned int> queue;
+  std::vector<TileDeque> deques;
+  std::vector<double> tile_times;
+  std::vector<double> thread_times;
+  unsigned int finished;
+  unsigned int steals;
+  double wall_time;
+};
+
+#endif // TILESCHEDULER_H
@@ -0,0 +1,77 @@
+// 02562 Rendering Framework
+// Floating point RGB image stored in square blocks of pixels.
+// Copyright (c) DTU Informatics 2011
+
+#include <vector>
+#include <algorithm>
+#include <optix_world.h>
+#include "ToneMap.h"
+#include "TiledImage.h"
+
+using namespace std;
+using namespace optix;
+
+TiledImage::TiledImage(unsigned int w, unsigned int h, unsigned int block_side)
+  : width(0), height(0), side(1), shift(0), mask(0), blocks_x(0), blocks_y(0)
+{
+  while(side < block_side)
+  {
+    side <<= 1;
+    ++shift;
+  }
+  mask = side - 1;
+  resize(w, h);
+}
+
+void TiledImage::resize(unsigned int w, unsigned int h)
+{
+  width = w;
+  height = h;
+  blocks_x = (w + mask) >> shift;
+  blocks_y = (h + mask) >> shift;
+  unsigned int no_of_blocks = blocks_x*blocks_y;
+  if(blocks.size() < no_of_blocks)
+    blocks.resize(no_of_blocks);
+  for(unsigned int i = 0; i < no_of_blocks; ++i)
+    blocks[i].resize(side*side);
+  dirty.resize(no_of_blocks);
+  clear();
+}
+
+void TiledImage::clear()
+{
+  for(unsigned int i = 0; i < get_no_of_blocks(); ++i)
+    std::fill(blocks[i].begin(), blocks[i].end(), make_float3(0.0f));
+  mark_all_dirty();
+}
+
+void TiledImage::mark_dirty(unsigned int x, unsigned int y, unsigned int w, unsigned int h)
+{
+  if(w == 0 || h == 0)
+    return;
+  for(unsigned int j = y >> shift; j <= (y + h - 1) >> shift; ++j)
+    for(unsigned int i = x >> shift; i <= (x + w - 1) >> shift; ++i)
+      dirty[j*blocks_x + i] = 1;
+}
+
+void TiledImage::get_block_area(unsigned int b, unsigned int& x, unsigned int& y, unsigned int& w, unsigned int& h) const
+{
+  x = (b%blocks_x) << shift;
+  y = (b/blocks_x) << shift;
+  w = std::min(side, width - x);
+  h = std::min(side, height - y);
+}
+
+void TiledImage::apply(const ToneMap& tone_map)
+{
+  for(unsigned int i = 0; i < get_no_of_blocks(); ++i)
+    tone_map.apply(&blocks[i][0].x, side, side, 3);
+  mark_all_dirty();
+}
+
+void TiledImage::unapply(const ToneMap& tone_map)
+{
+  for(unsigned int i = 0; i < get_no_of_blocks(); ++i)
+    tone_map.unapply(&blocks[i][0].x, side, side, 3);
+  mark_all_dirty();
+}
@@ -0,0 +1,69 @@
+// 02562 Rendering Framework
+// Floating point RGB image stored in square blocks of pixels.
+// Copyright (c) DTU Informatics 2011
+
+#ifndef TILEDIMAGE_H
+#define TILEDIMAGE_H
+
+#include <vector>
+#include <algorithm>
+#include <optix_world.h>
+#include "ToneMap.h"
+
+// The pixels of a block are stored row by row in an allocation of their
+// own, so a large image is not one huge allocation, a render tile writes
+// to memory close together, and resizing the image reuses the blocks
+// allocated so far. Blocks at the right and top edges are only partly
+// used. The side length of the blocks is a power of two. Blocks are marked
+// dirty when they change so that a display of the image only needs to
+// update those.
+class TiledImage
+{
+public:
+  TiledImage(unsigned int w = 0, unsigned int h = 0, unsigned int block_side = 64);
+
+  // Sets all pixels to zero and marks all blocks dirty
+  void resize(unsigned int w, unsigned int h);
+  void clear();
+
+  optix::float3& at(unsigned int x, unsigned int y)
+  {
+    return blocks[(y >> shift)*blocks_x + (x >> shift)][((y & mask) << shift) + (x & mask)];
+  }
+  const optix::float3& at(unsigned int x, unsigned int y) const
+  {
+    return blocks[(y >> shift)*blocks_x + (x >> shift)][((y & mask) << shift) + (x & mask)];
+  }
+
+  unsigned int get_width() const { return width; }
+  unsigned int get_height() const { return height; }
+  unsigned int get_block_side() const { return side; }
+  unsigned int get_no_of_blocks() const { return blocks_x*blocks_y; }
+
+  // Pixels of block b in rows of get_block_side() pixels. The lower left
+  // pixel of the block is (x, y) and w x h of its pixels are in the image.
+  const optix::float3* get_block(unsigned int b) const { return &blocks[b][0]; }
+  void get_block_area(unsigned int b, unsigned int& x, unsigned int& y, unsigned int& w, unsigned int& h) const;
+
+  // Marks the blocks overlapping the w x h pixels with lower left pixel (x, y)
+  void mark_dirty(unsigned int x, unsigned int y, unsigned int w, unsigned int h);
+  void mark_all_dirty() { std::fill(dirty.begin(), dirty.end(), 1); }
+  bool is_dirty(unsigned int b) const { return dirty[b] != 0; }
+  void clear_dirty() { std::fill(dirty.begin(), dirty.end(), 0); }
+
+  void apply(const ToneMap& tone_map);
+  void unapply(const ToneMap& tone_map);
+
+private:
+  unsigned int width;
+  unsigned int height;
+  unsigned int side;
+  unsigned int shift;
+  unsigned int mask;
+  unsigned int blocks_x;
+  unsigned int blocks_y;
+  std::vector< std::vector<optix::float3> > blocks;
+  std::vector<char> dirty;
+};
+
+#endif // TILEDIMAGE_H
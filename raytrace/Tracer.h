@@ -18,6 +18,7 @@ public:
   { }
 
   void set_scene(Scene* s) { scene = s; }
+  virtual void set_resolution(unsigned int w, unsigned int h) { width = w; height = h; }
   const Shader* get_shader(const HitInfo& hit) const { return scene ? scene->get_shader(hit) : 0; }
   void get_bsphere(optix::float3& center, float& radius) { if(scene) scene->get_bsphere(center, radius); }
 
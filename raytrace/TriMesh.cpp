@@ -60,26 +60,51 @@ bool TriMesh::intersect(const Ray& r, HitInfo& hit, unsigned int prim_idx) const
   float3 v2 = geometry.vertex(face.z);
 
   if(::intersect_triangle(r, v0, v1, v2, n, t, beta, gamma)){
-    float alpha = 1-(beta+gamma);
-    hit.has_hit = true;
-    hit.dist = t;
-    hit.position = r.origin + r.direction*t;
-    hit.geometric_normal = normalize(n);
-    if(has_normals()){
-      float3 n2 = alpha*normals.vertex(face.x) + beta*normals.vertex(face.y) + gamma*normals.vertex(face.z);
-      hit.shading_normal = normalize(n2);
-    } else {
-      hit.shading_normal = normalize(n);
-    }
-    hit.material = &materials[mat_idx.at(prim_idx)];
-    if(texcoords.no_faces()>0)
-      hit.texcoord = alpha*texcoords.vertex(face.x)+beta*texcoords.vertex(face.y)+gamma*texcoords.vertex(face.z);
+    fill_hit_info(r, hit, prim_idx, t, beta, gamma);
     return true;
   }
 
   return false;
 }
 
+bool TriMesh::get_triangle(unsigned int prim_idx, float3& v0, float3& v1, float3& v2) const
+{
+  const uint3& face = geometry.face(prim_idx);
+  v0 = geometry.vertex(face.x);
+  v1 = geometry.vertex(face.y);
+  v2 = geometry.vertex(face.z);
+  return true;
+}
+
+void TriMesh::fill_hit_info(const Ray& r, HitInfo& hit, unsigned int prim_idx, float t, float beta, float gamma) const
+{
+  const uint3& face = geometry.face(prim_idx);
+  const float3& v0 = geometry.vertex(face.x);
+  float3 n = cross(geometry.vertex(face.y) - v0, geometry.vertex(face.z) - v0);
+  float alpha = 1-(beta+gamma);
+  hit.has_hit = true;
+  hit.dist = t;
+  hit.position = r.origin + r.direction*t;
+  hit.geometric_normal = normalize(n);
+  if(has_normals()){
+    float3 n2 = alpha*normals.vertex(face.x) + beta*normals.vertex(face.y) + gamma*normals.vertex(face.z);
+    hit.shading_normal = normalize(n2);
+  } else {
+    hit.shading_normal = normalize(n);
+  }
+  hit.material = &materials[mat_idx.at(prim_idx)];
+  if(texcoords.no_faces()>0)
+    hit.texcoord = alpha*texcoords.vertex(face.x)+beta*texcoords.vertex(face.y)+gamma*texcoords.vertex(face.z);
+}
+
+bool TriMesh::intersect_any(const Ray& r, unsigned int prim_idx) const
+{
+  const uint3& face = geometry.face(prim_idx);
+  float3 n;
+  float beta, gamma, t;
+  return ::intersect_triangle(r, geometry.vertex(face.x), geometry.vertex(face.y), geometry.vertex(face.z), n, t, beta, gamma);
+}
+
 void TriMesh::transform(const Matrix4x4& m)
 {
   for(unsigned int i = 0; i < geometry.no_vertices(); ++i)
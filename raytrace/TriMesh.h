@@ -64,6 +64,15 @@ class TriMesh : public Object3D
   /// Compute intersection of ray with a triangle in the mesh
   virtual bool intersect(const optix::Ray& r, HitInfo& hit, unsigned int prim_idx) const;
 
+  /// Check whether a ray is blocked by a triangle in the mesh
+  virtual bool intersect_any(const optix::Ray& r, unsigned int prim_idx) const;
+
+  /// Get the vertices of a triangle in the mesh
+  virtual bool get_triangle(unsigned int prim_idx, optix::float3& v0, optix::float3& v1, optix::float3& v2) const;
+
+  /// Fill in hit info for a ray hitting a triangle at barycentric coordinates (beta, gamma)
+  virtual void fill_hit_info(const optix::Ray& r, HitInfo& hit, unsigned int prim_idx, float t, float beta, float gamma) const;
+
   /// Apply a transformation matrix to the mesh
   virtual void transform(const optix::Matrix4x4& m);
 
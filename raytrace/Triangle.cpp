@@ -82,17 +82,30 @@ bool Triangle::intersect(const Ray& r, HitInfo& hit, unsigned int prim_idx) cons
   float beta, gamma, t;
 
   if(::intersect_triangle(r, v0, v1, v2, n, t, beta, gamma)){
-    hit.has_hit = true;
-    hit.dist = t;
-    hit.position = r.origin + r.direction*t;
-    hit.geometric_normal = normalize(n);
-    hit.shading_normal = normalize(n);
-    hit.material = &material;
+    fill_hit_info(r, hit, prim_idx, t, beta, gamma);
     return true;
   }
     return false;
 }
 
+void Triangle::fill_hit_info(const Ray& r, HitInfo& hit, unsigned int prim_idx, float t, float beta, float gamma) const
+{
+  float3 n = normalize(compute_normal());
+  hit.has_hit = true;
+  hit.dist = t;
+  hit.position = r.origin + r.direction*t;
+  hit.geometric_normal = n;
+  hit.shading_normal = n;
+  hit.material = &material;
+}
+
+bool Triangle::intersect_any(const Ray& r, unsigned int prim_idx) const
+{
+  float3 n;
+  float beta, gamma, t;
+  return ::intersect_triangle(r, v0, v1, v2, n, t, beta, gamma);
+}
+
 void Triangle::transform(const Matrix4x4& m) 
 { 
   v0 = make_float3(m*make_float4(v0, 1.0f)); 
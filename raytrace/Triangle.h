@@ -33,6 +33,13 @@ public:
   { }
 
   virtual bool intersect(const optix::Ray& ray, HitInfo& hit, unsigned int prim_idx) const;
+  virtual bool intersect_any(const optix::Ray& ray, unsigned int prim_idx) const;
+  virtual bool get_triangle(unsigned int prim_idx, optix::float3& vert0, optix::float3& vert1, optix::float3& vert2) const
+  {
+    vert0 = v0; vert1 = v1; vert2 = v2;
+    return true;
+  }
+  virtual void fill_hit_info(const optix::Ray& r, HitInfo& hit, unsigned int prim_idx, float t, float beta, float gamma) const;
   virtual void transform(const optix::Matrix4x4& m);
   virtual optix::Aabb compute_bbox() const;
 
@@ -0,0 +1,242 @@
+// 02562 Rendering Framework
+// Precomputed triangle storage for the leaves of an acceleration structure.
+// Copyright (c) DTU Informatics 2011
+
+#include <vector>
+#include <optix_world.h>
+#include "AccObj.h"
+#include "Object3D.h"
+#include "simd_support.h"
+#include "TriangleBuffer.h"
+
+using namespace std;
+using namespace optix;
+
+namespace
+{
+  // Threshold on the determinant used by intersect_triangle(...) in Triangle.cpp
+  const float det_eps = 0.00001f;
+
+#ifdef RT_SSE
+  // Intersects a ray with the four triangles of a block. The arithmetic is
+  // the same as in the scalar kernel, operation by operation and without
+  // approximate reciprocals, so the results are bit-identical. Returns a
+  // mask with a bit set for every triangle hit within [tmin, tmax].
+  RT_SSE2_FUNCTION inline int intersect_block(const TriangleBlock& b,
+                                              const __m128& o_x, const __m128& o_y, const __m128& o_z,
+                                              const __m128& d_x, const __m128& d_y, const __m128& d_z,
+                                              const __m128& tmin, const __m128& tmax,
+                                              __m128& t, __m128& beta, __m128& gamma)
+  {
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 e0_x = _mm_loadu_ps(b.e0_x), e0_y = _mm_loadu_ps(b.e0_y), e0_z = _mm_loadu_ps(b.e0_z);
+    __m128 e1_x = _mm_loadu_ps(b.e1_x), e1_y = _mm_loadu_ps(b.e1_y), e1_z = _mm_loadu_ps(b.e1_z);
+
+    // n = cross(e0, e1)
+    __m128 n_x = _mm_sub_ps(_mm_mul_ps(e0_y, e1_z), _mm_mul_ps(e0_z, e1_y));
+    __m128 n_y = _mm_sub_ps(_mm_mul_ps(e0_z, e1_x), _mm_mul_ps(e0_x, e1_z));
+    __m128 n_z = _mm_sub_ps(_mm_mul_ps(e0_x, e1_y), _mm_mul_ps(e0_y, e1_x));
+
+    // q = dot(direction, n)
+    __m128 q = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d_x, n_x), _mm_mul_ps(d_y, n_y)), _mm_mul_ps(d_z, n_z));
+    __m128 mask = _mm_cmpnlt_ps(_mm_andnot_ps(sign, q), _mm_set1_ps(det_eps));
+    q = _mm_div_ps(_mm_set1_ps(1.0f), q);
+
+    // v0org = v0 - origin, i = cross(v0org, direction)
+    __m128 a_x = _mm_sub_ps(_mm_loadu_ps(b.v0_x), o_x);
+    __m128 a_y = _mm_sub_ps(_mm_loadu_ps(b.v0_y), o_y);
+    __m128 a_z = _mm_sub_ps(_mm_loadu_ps(b.v0_z), o_z);
+    __m128 i_x = _mm_sub_ps(_mm_mul_ps(a_y, d_z), _mm_mul_ps(a_z, d_y));
+    __m128 i_y = _mm_sub_ps(_mm_mul_ps(a_z, d_x), _mm_mul_ps(a_x, d_z));
+    __m128 i_z = _mm_sub_ps(_mm_mul_ps(a_x, d_y), _mm_mul_ps(a_y, d_x));
+
+    beta = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(i_x, e1_x), _mm_mul_ps(i_y, e1_y)), _mm_mul_ps(i_z, e1_z)), q);
+    gamma = _mm_xor_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(i_x, e0_x), _mm_mul_ps(i_y, e0_y)), _mm_mul_ps(i_z, e0_z)), sign);
+    gamma = _mm_mul_ps(gamma, q);
+    const __m128 zero = _mm_setzero_ps();
+    mask = _mm_and_ps(mask, _mm_cmpnlt_ps(beta, zero));
+    mask = _mm_and_ps(mask, _mm_cmpnlt_ps(gamma, zero));
+    mask = _mm_and_ps(mask, _mm_cmpngt_ps(_mm_add_ps(beta, gamma), _mm_set1_ps(1.0f)));
+
+    t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a_x, n_x), _mm_mul_ps(a_y, n_y)), _mm_mul_ps(a_z, n_z)), q);
+    mask = _mm_and_ps(mask, _mm_cmpngt_ps(t, tmax));
+    mask = _mm_and_ps(mask, _mm_cmpnlt_ps(t, tmin));
+    return _mm_movemask_ps(mask);
+  }
+
+  RT_SSE2_FUNCTION int intersect_sse(const TriangleBlock* blocks, const Ray& r, unsigned int first, unsigned int count,
+                                     float& t, float& beta, float& gamma)
+  {
+    __m128 o_x = _mm_set1_ps(r.origin.x), o_y = _mm_set1_ps(r.origin.y), o_z = _mm_set1_ps(r.origin.z);
+    __m128 d_x = _mm_set1_ps(r.direction.x), d_y = _mm_set1_ps(r.direction.y), d_z = _mm_set1_ps(r.direction.z);
+    __m128 tmin = _mm_set1_ps(r.tmin);
+    float t_max = r.tmax;
+    int closest = -1;
+    unsigned int end = first + count;
+    for(unsigned int i = first; i < end; i += triangle_block_size)
+    {
+      __m128 bt, bbeta, bgamma;
+      int hits = intersect_block(blocks[i/triangle_block_size], o_x, o_y, o_z, d_x, d_y, d_z, tmin, _mm_set1_ps(t_max), bt, bbeta, bgamma);
+      if(hits == 0)
+        continue;
+
+      // Resolve the hits in slot order like the scalar loop does
+      float lane_t[triangle_block_size], lane_beta[triangle_block_size], lane_gamma[triangle_block_size];
+      _mm_storeu_ps(lane_t, bt);
+      _mm_storeu_ps(lane_beta, bbeta);
+      _mm_storeu_ps(lane_gamma, bgamma);
+      for(unsigned int j = 0; j < triangle_block_size; ++j)
+      {
+        if((hits & (1 << j)) && !(lane_t[j] > t_max))
+        {
+          t_max = lane_t[j];
+          beta = lane_beta[j];
+          gamma = lane_gamma[j];
+          closest = i + j;
+        }
+      }
+    }
+    t = t_max;
+    return closest;
+  }
+
+  RT_SSE2_FUNCTION bool intersect_any_sse(const TriangleBlock* blocks, const Ray& r, unsigned int first, unsigned int count)
+  {
+    __m128 o_x = _mm_set1_ps(r.origin.x), o_y = _mm_set1_ps(r.origin.y), o_z = _mm_set1_ps(r.origin.z);
+    __m128 d_x = _mm_set1_ps(r.direction.x), d_y = _mm_set1_ps(r.direction.y), d_z = _mm_set1_ps(r.direction.z);
+    __m128 tmin = _mm_set1_ps(r.tmin);
+    __m128 tmax = _mm_set1_ps(r.tmax);
+    unsigned int end = first + count;
+    for(unsigned int i = first; i < end; i += triangle_block_size)
+    {
+      __m128 t, beta, gamma;
+      if(intersect_block(blocks[i/triangle_block_size], o_x, o_y, o_z, d_x, d_y, d_z, tmin, tmax, t, beta, gamma))
+        return true;
+    }
+    return false;
+  }
+#endif
+}
+
+void TriangleBuffer::init(const vector<AccObj*>& objects)
+{
+  int n = static_cast<int>(objects.size());
+  blocks.resize(padded_size(n)/triangle_block_size);
+  triangle.resize(n);
+
+  #pragma omp parallel for if(n > 4096)
+  for(int i = 0; i < n; ++i)
+  {
+    const AccObj* obj = objects[i];
+    float3 v0, v1, v2;
+    triangle[i] = obj && obj->geometry->get_triangle(obj->prim_idx, v0, v1, v2);
+    if(!triangle[i])
+      v0 = v1 = v2 = make_float3(0.0f);
+    float3 e0 = v1 - v0;
+    float3 e1 = v2 - v0;
+    TriangleBlock& b = blocks[i/triangle_block_size];
+    unsigned int j = i%triangle_block_size;
+    b.v0_x[j] = v0.x; b.v0_y[j] = v0.y; b.v0_z[j] = v0.z;
+    b.e0_x[j] = e0.x; b.e0_y[j] = e0.y; b.e0_z[j] = e0.z;
+    b.e1_x[j] = e1.x; b.e1_y[j] = e1.y; b.e1_z[j] = e1.z;
+  }
+
+  // Clear the slots after the last object
+  for(unsigned int i = n; i < blocks.size()*triangle_block_size; ++i)
+  {
+    TriangleBlock& b = blocks[i/triangle_block_size];
+    unsigned int j = i%triangle_block_size;
+    b.v0_x[j] = b.v0_y[j] = b.v0_z[j] = 0.0f;
+    b.e0_x[j] = b.e0_y[j] = b.e0_z[j] = 0.0f;
+    b.e1_x[j] = b.e1_y[j] = b.e1_z[j] = 0.0f;
+  }
+
+  all_triangles = true;
+  for(int i = 0; i < n; ++i)
+    if(objects[i] && !triangle[i])
+      all_triangles = false;
+}
+
+void TriangleBuffer::clear()
+{
+  vector<TriangleBlock>().swap(blocks);
+  vector<unsigned char>().swap(triangle);
+  all_triangles = true;
+}
+
+int TriangleBuffer::intersect(const Ray& r, unsigned int first, unsigned int count, float& t, float& beta, float& gamma) const
+{
+  if(count == 0)
+    return -1;
+#ifdef RT_SSE
+  if(simd)
+    return intersect_sse(&blocks[0], r, first, count, t, beta, gamma);
+#endif
+  Ray ray = r;
+  int closest = -1;
+  for(unsigned int i = first; i < first + count; ++i)
+  {
+    float t_i, beta_i, gamma_i;
+    if(intersect_triangle(ray, i, t_i, beta_i, gamma_i))
+    {
+      ray.tmax = t_i;
+      beta = beta_i;
+      gamma = gamma_i;
+      closest = i;
+    }
+  }
+  t = ray.tmax;
+  return closest;
+}
+
+bool TriangleBuffer::intersect_any(const Ray& r, unsigned int first, unsigned int count) const
+{
+  if(count == 0)
+    return false;
+#ifdef RT_SSE
+  if(simd)
+    return intersect_any_sse(&blocks[0], r, first, count);
+#endif
+  for(unsigned int i = first; i < first + count; ++i)
+  {
+    float t, beta, gamma;
+    if(intersect_triangle(r, i, t, beta, gamma))
+      return true;
+  }
+  return false;
+}
+
+bool TriangleBuffer::has_simd()
+{
+  return cpu_has_sse2();
+}
+
+bool TriangleBuffer::intersect_triangle(const Ray& r, unsigned int i, float& t, float& beta, float& gamma) const
+{
+  const TriangleBlock& b = blocks[i/triangle_block_size];
+  unsigned int j = i%triangle_block_size;
+  const float3 v0 = make_float3(b.v0_x[j], b.v0_y[j], b.v0_z[j]);
+  const float3 e0 = make_float3(b.e0_x[j], b.e0_y[j], b.e0_z[j]);
+  const float3 e1 = make_float3(b.e1_x[j], b.e1_y[j], b.e1_z[j]);
+
+  // Same arithmetic as intersect_triangle(...) in Triangle.cpp
+  float3 n = cross(e0, e1);
+  float q = dot(r.direction, n);
+  if(fabs(q) < det_eps)
+    return false;
+
+  q = 1.0f/q;
+
+  float3 v0org = v0 - r.origin;
+  float3 c = cross(v0org, r.direction);
+
+  beta = dot(c, e1)*q;
+  gamma = -dot(c, e0)*q;
+
+  if(beta < 0.0f || gamma < 0.0f || (beta + gamma) > 1.0f)
+    return false;
+
+  t = dot(v0org, n)*q;
+
+  return !(t > r.tmax || t < r.tmin);
+}
@@ -0,0 +1,67 @@
+// 02562 Rendering Framework
+// Precomputed triangle storage for the leaves of an acceleration structure.
+// Copyright (c) DTU Informatics 2011
+
+#ifndef TRIANGLEBUFFER_H
+#define TRIANGLEBUFFER_H
+
+#include <vector>
+#include <optix_world.h>
+#include "AccObj.h"
+
+// Number of triangles intersected at once by the SIMD kernel
+const unsigned int triangle_block_size = 4;
+
+// First vertex and edge vectors of a block of triangles in
+// structure-of-arrays layout (one SSE register per component).
+struct TriangleBlock
+{
+  float v0_x[triangle_block_size], v0_y[triangle_block_size], v0_z[triangle_block_size];
+  float e0_x[triangle_block_size], e0_y[triangle_block_size], e0_z[triangle_block_size];
+  float e1_x[triangle_block_size], e1_y[triangle_block_size], e1_z[triangle_block_size];
+};
+
+// Stores the first vertex and the two edge vectors of every triangle
+// referenced by an accelerator. Slot i corresponds to objects[i] of the
+// array the buffer was built from. Accelerators start every leaf at a
+// multiple of triangle_block_size (see padded_size) and fill the gap with
+// null objects, so the triangles of a leaf occupy whole blocks. Objects
+// that are not triangles are stored as degenerate triangles that never
+// hit and must be intersected through their geometry.
+class TriangleBuffer
+{
+public:
+  TriangleBuffer() : all_triangles(true), simd(has_simd()) { }
+
+  void init(const std::vector<AccObj*>& objects);
+  void clear();
+
+  // Find the closest triangle in slots [first, first + count) intersected
+  // within [r.tmin, r.tmax]. The result is the slot of the triangle or -1.
+  int intersect(const optix::Ray& r, unsigned int first, unsigned int count, float& t, float& beta, float& gamma) const;
+  bool intersect_any(const optix::Ray& r, unsigned int first, unsigned int count) const;
+
+  bool is_triangle(unsigned int i) const { return triangle[i] != 0; }
+  bool only_triangles() const { return all_triangles; }
+
+  // The SIMD kernel is used if the processor supports it. Disabling it
+  // selects the scalar kernel, which gives bit-identical results.
+  void set_simd(bool enable) { simd = enable && has_simd(); }
+  bool get_simd() const { return simd; }
+  static bool has_simd();
+
+  static unsigned int padded_size(unsigned int count)
+  {
+    return (count + triangle_block_size - 1)/triangle_block_size*triangle_block_size;
+  }
+
+private:
+  bool intersect_triangle(const optix::Ray& r, unsigned int i, float& t, float& beta, float& gamma) const;
+
+  std::vector<TriangleBlock> blocks;
+  std::vector<unsigned char> triangle;
+  bool all_triangles;
+  bool simd;
+};
+
+#endif // TRIANGLEBUFFER_H
@@ -2,31 +2,52 @@
 #define MT_RANDOM_H
 
 #include "Randomizer.h"
-extern Randomizer randomizer;
+
+// Every thread draws from its own generator, which is created the first
+// time the thread needs it and kept for the rest of the run, so parallel
+// regions neither share nor reinitialize generator states.
+Randomizer& thread_randomizer();
+
+// Restarts the generator of the calling thread at a state that only
+// depends on the arguments. Seeding at the start of every tile with the
+// tile and pass number makes an image independent of which thread
+// rendered which tile. This is a few operations with PCG32, but MT19937
+// cannot jump and rebuilds its 624-word state, roughly a thousand times
+// per pass of a 512x512 image.
+void seed_thread_randomizer(unsigned long seed, unsigned int tile, unsigned int pass);
+
+// Moves the generator of the calling thread to the numbers of a sample
+// of a pixel (see Randomizer::seek), which is cheap with PCG32
+void seek_thread_randomizer(unsigned long seed, unsigned int pixel, unsigned int sample);
+
+// Generator used by all threads from their next seeding on (PCG32 unless
+// set to MT19937)
+void set_random_generator(RandomGenerator type);
+RandomGenerator get_random_generator();
 
 // generates a random number on [0,1]-real-interval
 inline double mt_random()
 {
-  return randomizer.mt_random();
+  return thread_randomizer().mt_random();
 }
 
 // generates a random number on [0,1)-real-interval
 inline double mt_random_half_open()
 {
-  return randomizer.mt_random_half_open();
+  return thread_randomizer().mt_random_half_open();
 }
 
 // generates a random number on (0,1)-real-interval
 inline double mt_random_open()
 {
-  return randomizer.mt_random_open();
+  return thread_randomizer().mt_random_open();
 }
 
 // Use the following function in constructors that 
 // could be used for global variable instances.
 inline double safe_mt_random()
 {
-  return randomizer.safe_mt_random();
+  return thread_randomizer().safe_mt_random();
 }
 
 #endif // MT_RANDOM_H
@@ -7,4 +7,12 @@
 #include <GL/glut.h>
 #endif
 
+// Set when rendering without a display (see RenderEngine::render_batch),
+// where there is no OpenGL context and no OpenGL calls may be made
+inline bool& headless()
+{
+  static bool no_display = false;
+  return no_display;
+}
+
 #endif
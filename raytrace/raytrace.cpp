@@ -2,10 +2,15 @@
 // Written by Jeppe Revall Frisvad, 2011
 // Copyright (c) DTU Informatics 2011
 
+#include <string>
 #include "RenderEngine.h"
 
 int main(int argc, char** argv)
 {
+  // Render without a window: raytrace --batch [options] [scene files]
+  if(argc > 1 && std::string(argv[1]) == "--batch")
+    return render_engine.render_batch(argc - 1, argv + 1);
+
   render_engine.init_GLUT(argc, argv);
   render_engine.load_files(argc, argv);
 
@@ -8,6 +8,7 @@
 #include <cmath>
 #include <optix_world.h>
 #include "mt_random.h"
+#include "PixelSampler.h"
 
 // Given a direction vector v sampled on the hemisphere
 // over a surface point with the z-axis as its normal,
@@ -57,8 +58,8 @@ inline optix::float3 sample_hemisphere(const optix::float3& normal)
 inline optix::float3 sample_cosine_weighted(const optix::float3& normal)
 {
   // Get random numbers
-  float rand1 = mt_random_half_open();
-  float rand2 = mt_random_half_open();
+  float rand1 = next_sample();
+  float rand2 = next_sample();
 
   // Calculate new direction as if the z-axis were the normal
   float theta = acosf(sqrtf(1.0-rand1));
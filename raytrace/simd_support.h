@@ -0,0 +1,34 @@
+// 02562 Rendering Framework
+// Compile and run time detection of SSE2 support for the SIMD kernels
+// of the acceleration structures.
+// Copyright (c) DTU Informatics 2011
+
+#ifndef SIMD_SUPPORT_H
+#define SIMD_SUPPORT_H
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define RT_SSE
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define RT_SSE2_FUNCTION
+#else
+#define RT_SSE2_FUNCTION __attribute__((target("sse2")))
+#endif
+#endif
+
+// True if the SSE2 kernels are compiled in and the processor supports them
+inline bool cpu_has_sse2()
+{
+#if defined(RT_SSE) && defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[3] & (1 << 26)) != 0;
+#elif defined(RT_SSE)
+  return __builtin_cpu_supports("sse2");
+#else
+  return false;
+#endif
+}
+
+#endif // SIMD_SUPPORT_H